@@ -0,0 +1,79 @@
+//
+// Page cache hints for the model's input and output files, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CPDN_cache.h"
+#include "CPDN_control_code.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    // Returns the size of the file advised, 0 if it couldn't be.
+    std::uint64_t advise_file(const fs::path& path, int advice) {
+        std::uint64_t size = 0;
+#if defined(POSIX_FADV_WILLNEED)
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return 0;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && posix_fadvise(fd, 0, 0, advice) == 0) {
+           size = st.st_size;
+        }
+        ::close(fd);
+#endif
+        return size;
+    }
+}
+
+
+cache_hints cache_hints::from_env() {
+    cache_hints hints;
+    hints.prefetch     = get_env_int("CPDN_PREFETCH", 1) != 0;
+    hints.drop         = get_env_int("CPDN_DROP_CACHE", 1) != 0;
+    hints.write_behind = get_env_int("CPDN_WRITE_BEHIND", 1) != 0;
+    return hints;
+}
+
+
+std::uint64_t prefetch_files(const std::vector<fs::path>& paths, std::uint64_t max_bytes) {
+    std::uint64_t requested = 0;
+#if defined(POSIX_FADV_WILLNEED)
+    std::error_code ec;
+    bool full = false;
+    auto prefetch = [&](const fs::path& file) {
+       std::uint64_t size = fs::file_size(file, ec);
+       if (ec) return;
+       if (requested + size > max_bytes) {
+          full = true;
+          return;
+       }
+       requested += advise_file(file, POSIX_FADV_WILLNEED);
+    };
+
+    for (const auto& path : paths) {
+       if (full) break;
+       if (fs::is_directory(path, ec)) {
+          for (const auto& entry : fs::recursive_directory_iterator(path, ec)) {
+             if (entry.is_regular_file(ec)) prefetch(entry.path());
+             if (full) break;
+          }
+       }
+       else if (fs::is_regular_file(path, ec)) {
+          prefetch(path);
+       }
+    }
+#endif
+    return requested;
+}
+
+
+void drop_cached(const fs::path& path) {
+#if defined(POSIX_FADV_DONTNEED)
+    advise_file(path, POSIX_FADV_DONTNEED);
+#endif
+}
@@ -0,0 +1,30 @@
+//
+// Page cache hints for the model's input and output files, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+
+// Which page cache hints to use. Each can be turned off, for benchmarking, with CPDN_PREFETCH=0,
+// CPDN_DROP_CACHE=0 or CPDN_WRITE_BEHIND=0.
+struct cache_hints {
+    bool prefetch     = true;     // read the staged input files into the cache before the model starts
+    bool drop         = true;     // drop output files from the cache once they've been compressed
+    bool write_behind = true;     // write large files to disk as they're written by cpdn_zip & cpdn_unzip
+
+    static cache_hints from_env();
+};
+
+// Ask the kernel to start reading the files into the page cache (POSIX_FADV_WILLNEED), without waiting.
+// Directories are read recursively. Stops at the first file that would take it over max_bytes. Returns the bytes requested.
+std::uint64_t prefetch_files(const std::vector<std::filesystem::path>&, std::uint64_t max_bytes);
+
+// Drop the clean pages of a file from the page cache (POSIX_FADV_DONTNEED). Dirty pages are not
+// written out for this, so a file that's about to be deleted costs no extra disk writes.
+void drop_cached(const std::filesystem::path&);
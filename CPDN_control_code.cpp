@@ -7,7 +7,8 @@
 
 #include <iomanip>
 #include "CPDN_control_code.h"
-#include "openifs.h"
+#include "CPDN_trace.h"
+#include "CPDN_upload.h"
 
 // Initialise BOINC and set the options
 int initialise_boinc(std::string& wu_name, std::string& project_dir, std::string& version, int& standalone) {
@@ -48,6 +49,59 @@ bool set_env_var(const std::string& name, const std::string& val) {
     return (setenv(name.c_str(), val.c_str(), 1) == 0);     // 1 = overwrite existing value, true on success.
 }
 
+// Set a variable in an environment block for a child process (see launch_model), replacing any existing value.
+void set_env_var(std::vector<std::string>& env, const std::string& name, const std::string& val) {
+    const std::string prefix = name + "=";
+    for (auto& var : env) {
+       if (var.compare(0, prefix.length(), prefix) == 0) {
+          var = prefix + val;
+          return;
+       }
+    }
+    env.push_back(prefix + val);
+}
+
+// Value of a variable in an environment block, empty if it's not set.
+std::string get_env_var(const std::vector<std::string>& env, const std::string& name) {
+    const std::string prefix = name + "=";
+    for (const auto& var : env) {
+       if (var.compare(0, prefix.length(), prefix) == 0) {
+          return var.substr(prefix.length());
+       }
+    }
+    return std::string();
+}
+
+// A copy of this process's environment, to be changed for a child process.
+// Variables whose names start with exclude (if not empty) are left out.
+std::vector<std::string> current_environment(const std::string& exclude) {
+    std::vector<std::string> env;
+    for (char** var = environ; var != NULL && *var != NULL; var++) {
+       if (exclude.empty() || strncmp(*var, exclude.c_str(), exclude.size()) != 0) {
+          env.emplace_back(*var);
+       }
+    }
+    return env;
+}
+
+
+// Returns the value of a control code tunable held in an integer environment variable,
+// or the default if it is not set or not a valid integer.
+// Tunables are named CPDN_* and can be set per host in the override file (see process_env_overrides).
+int get_env_int(const std::string& name, int default_value) {
+    const char* val = getenv(name.c_str());
+    if (val == NULL || *val == '\0') {
+       return default_value;
+    }
+    char* end = NULL;
+    long ival = strtol(val, &end, 10);
+    if (*end != '\0') {
+       std::cerr << "..Warning, ignoring invalid value for " << name << ": " << val << '\n';
+       return default_value;
+    }
+    return (int) ival;
+}
+
 
 // Next two functions allow the use of an override file to set environment variables for testing
 // on live tasks on remote machines.  The file is a simple text file with one variable per line in the format:
@@ -110,52 +164,74 @@ bool parse_export(const std::string& line, std::string& name, std::string& value
 }
 
 
-/**
- * @brief Checks for the override file and sets environment variables if found.
- * * 
- * @param project_path The base directory.
- * @param filename The override environment filename.
- * @return true if environment variables were successfully processed, false otherwise.
- */
-bool process_env_overrides(const fs::path& override_envs)
-{
-    if (!fs::exists(override_envs)) {
-        // Fail silently to avoid highlighting existence of file
-        //std::cerr << "Override file not found: " << override_envs.string() << std::endl;
-        return false;
-    }
-
-    // debugging only. don't advertise existence of file
-    //std::cerr << "Processing environment overrides from: " << override_envs.string() << std::endl;
-    
-    std::ifstream file(override_envs);
-    if (!file.is_open()) {
-        // Fail silently
-        //std::cerr << "Error: Could not open override file for reading." << std::endl;
-        return false;
-    }
-
-    std::string line;
-    bool success = true;
-    while (std::getline(file, line))
+namespace {
+    // Read the override file and pass each variable whose name starts with prefix, and not with exclude, to set_var.
+    bool read_env_overrides(const fs::path& override_envs, const std::string& prefix, const std::string& exclude,
+                            const std::function<void(const std::string&, const std::string&)>& set_var)
     {
-        std::string var_name;
-        std::string var_value;
+        if (!fs::exists(override_envs)) {
+            // Fail silently to avoid highlighting existence of file
+            //std::cerr << "Override file not found: " << override_envs.string() << std::endl;
+            return false;
+        }
 
-        if (parse_export(line, var_name, var_value))
+        // debugging only. don't advertise existence of file
+        //std::cerr << "Processing environment overrides from: " << override_envs.string() << std::endl;
+        
+        std::ifstream file(override_envs);
+        if (!file.is_open()) {
+            // Fail silently
+            //std::cerr << "Error: Could not open override file for reading." << std::endl;
+            return false;
+        }
+
+        std::string line;
+        bool success = true;
+        while (std::getline(file, line))
         {
-            try {
-                set_env_var(var_name, var_value);
-                std::cerr << "Overriding env var: " << var_name << " = " << var_value << '\n';
-            } 
-            catch (const std::exception& e) {
-                std::cerr << "Error setting variable: " << e.what() << std::endl;
-                success = false;
+            std::string var_name;
+            std::string var_value;
+
+            if (parse_export(line, var_name, var_value) && var_name.rfind(prefix, 0) == 0 &&
+                (exclude.empty() || var_name.rfind(exclude, 0) != 0))
+            {
+                try {
+                    set_var(var_name, var_value);
+                    std::cerr << "Overriding env var: " << var_name << " = " << var_value << '\n';
+                } 
+                catch (const std::exception& e) {
+                    std::cerr << "Error setting variable: " << e.what() << std::endl;
+                    success = false;
+                }
             }
         }
+
+        return success;
     }
+}
 
-    return success;
+/**
+ * @brief Checks for the override file and sets environment variables if found.
+ * * 
+ * @param override_envs The override environment file.
+ * @param prefix Only set variables whose names start with this prefix (default all).
+ * @return true if environment variables were successfully processed, false otherwise.
+ */
+bool process_env_overrides(const fs::path& override_envs, const std::string& prefix)
+{
+    return read_env_overrides(override_envs, prefix, "",
+                              [](const std::string& name, const std::string& val) { set_env_var(name, val); });
+}
+
+/**
+ * @brief As above, but the variables are set in the environment block for a child process.
+ *        Variables whose names start with exclude (if not empty) are not set, e.g. the control code's own tunables.
+ */
+bool process_env_overrides(const fs::path& override_envs, std::vector<std::string>& env, const std::string& prefix,
+                           const std::string& exclude)
+{
+    return read_env_overrides(override_envs, prefix, exclude,
+                              [&env](const std::string& name, const std::string& val) { set_env_var(env, name, val); });
 }
 
 
@@ -213,7 +289,9 @@ int move_and_unzip_app_file(std::string app_name, std::string version, std::stri
     // Unzip the app zipfile
     std::cerr << "Extracting the app zipfile: " << app_destination << "\n";
 
-    if (!cpdn_unzip(app_destination, slot_path)){
+    std::atomic<bool> cancel(false);
+    cpdn_zip_control control = boinc_zip_control("app zipfile", cancel);
+    if (!cpdn_unzip(app_destination, slot_path, &control)){
        retval = 1;
        std::cerr << "..Extracting the app zipfile failed" << "\n";
        return retval;
@@ -229,6 +307,40 @@ int move_and_unzip_app_file(std::string app_name, std::string version, std::stri
 }
 
 
+// Progress and cancellation for a long cpdn_zip or cpdn_unzip, so the BOINC client is serviced while it runs.
+// Logs the progress every 10%, waits while the client has suspended the task, and sets 'cancel'
+// to stop the operation on a quit or abort request or if the client has gone.
+cpdn_zip_control boinc_zip_control(const std::string& name, std::atomic<bool>& cancel) {
+    constexpr std::uint64_t ZIP_LOG_SIZE = 64 * 1024 * 1024;    // only log progress for larger files
+
+    cpdn_zip_control control;
+    control.cancel = &cancel;
+    control.progress = [name, &cancel, logged = -1](std::uint64_t done, std::uint64_t total) mutable {
+       int percent = (total > 0) ? (int) (done * 100 / total) : 100;
+       if (total >= ZIP_LOG_SIZE && percent / 10 > logged) {
+          logged = percent / 10;
+          std::cerr << name << ": " << percent << "% done\n";
+       }
+
+       BOINC_STATUS status;
+       boinc_get_status(&status);
+       if (status.suspended && !(status.quit_request || status.abort_request || status.no_heartbeat)) {
+          std::cerr << "Suspend request received from the BOINC client, pausing: " << name << '\n';
+          while (status.suspended && !(status.quit_request || status.abort_request || status.no_heartbeat)) {
+             std::this_thread::sleep_for(chrono::seconds(1));
+             boinc_get_status(&status);
+          }
+          std::cerr << "Resuming: " << name << '\n';
+       }
+       if (status.quit_request || status.abort_request || status.no_heartbeat) {
+          std::cerr << "Quit or abort request received from the BOINC client, stopping: " << name << '\n';
+          cancel = true;
+       }
+    };
+    return control;
+}
+
+
 int check_child_status(long handleProcess, int process_status) {
     int stat,pid;
 
@@ -263,7 +375,61 @@ int check_child_status(long handleProcess, int process_status) {
 }
 
 
-int check_boinc_status(long handleProcess, int process_status) {
+/**
+ * @brief Waits up to timeout_secs for the child process to terminate and reaps it.
+ *        Returns immediately if the child has already been reaped (e.g. by check_child_status).
+ *        Uses a pidfd (the one given, e.g. from launch_model, or a new one) to sleep until the
+ *        child exits where the kernel supports it, otherwise polls waitpid with backoff.
+ * @return true if the child has terminated, false on timeout.
+ */
+bool wait_for_child(long handleProcess, int timeout_secs, int pidfd) {
+    siginfo_t info;
+
+    // Still our child (running or zombie)? If not, it's already been reaped.
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PID, handleProcess, &info, WEXITED | WNOHANG | WNOWAIT) != 0) {
+       return true;
+    }
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    // The pid can't be reused while it's an unreaped child, so the pidfd refers to the model.
+    bool own_pidfd = (pidfd < 0);
+    if (own_pidfd) {
+       pidfd = syscall(SYS_pidfd_open, (pid_t) handleProcess, 0);
+    }
+    if (pidfd >= 0) {
+       struct pollfd pfd = { pidfd, POLLIN, 0 };
+       int ready = poll(&pfd, 1, timeout_secs * 1000);
+       if (own_pidfd) close(pidfd);
+       if (ready > 0) {
+          waitpid(handleProcess, NULL, 0);
+          return true;
+       }
+       std::cerr << "..wait_for_child: child process " << handleProcess << " still running after " << timeout_secs << " secs\n";
+       return false;
+    }
+#endif
+
+    // No pidfd support, poll with backoff
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(timeout_secs);
+    auto interval = chrono::milliseconds(10);
+    do {
+       pid_t pid = waitpid(handleProcess, NULL, WNOHANG);
+       if (pid == handleProcess || (pid < 0 && errno == ECHILD)) {
+          return true;
+       }
+       std::this_thread::sleep_for(interval);
+       interval = std::min(interval * 2, chrono::milliseconds(1000));
+    } while (chrono::steady_clock::now() < deadline);
+
+    std::cerr << "..wait_for_child: child process " << handleProcess << " still running after " << timeout_secs << " secs\n";
+    return false;
+}
+
+
+// The time the model spends suspended is added to suspended_secs, if given, and the upload worker
+// (if given) is paused for that time too.
+int check_boinc_status(long handleProcess, int process_status, double* suspended_secs, UploadWorker* upload_worker) {
     BOINC_STATUS status;
     boinc_get_status(&status);
 
@@ -291,6 +457,17 @@ int check_boinc_status(long handleProcess, int process_status) {
        if (status.suspended) {
           std::cerr << "Suspend request received from the BOINC client, suspending the child process" << '\n';
           kill(handleProcess, SIGSTOP);
+          if (upload_worker) upload_worker->pause(true);
+          struct resume_uploads {
+             UploadWorker* worker;
+             ~resume_uploads() { if (worker) worker->pause(false); }
+          } resume { upload_worker };
+          ScopedTimer suspended("suspended", "boinc");
+          struct add_suspended_time {
+             double* secs;
+             chrono::steady_clock::time_point start = chrono::steady_clock::now();
+             ~add_suspended_time() { if (secs) *secs += chrono::duration<double>(chrono::steady_clock::now() - start).count(); }
+          } suspended_time { suspended_secs };
 
           while (status.suspended) {
              boinc_get_status(&status);
@@ -323,95 +500,109 @@ int check_boinc_status(long handleProcess, int process_status) {
     }
 }
 
-// GC. TODO. There does not need to be two separate functions for launching WRF and OpenIFS.
-//     This should be combined with more args to handle differences.
-// Returns process id on success, -1 on failure.
-long launch_process_oifs(const std::string& project_path, const std::string& slot_path, 
-                         const std::string& strCmd, const std::string& nthreads,
-                         const std::string& exptid, const std::string& app_name)
+// Start a model process. Used for both OpenIFS and WRF.
+// The environment, arguments and limits are all prepared in the parent (see launch_spec) and the process
+// is started with posix_spawn, which doesn't copy the parent's memory and reports exec failures.
+// Resource limits and the cpu affinity are set for the child only: the parent's soft limits and
+// the affinity of the calling thread are changed just while spawning, as the child inherits them.
+// Returns the process id, and a pidfd where supported, or pid -1 on failure.
+child_process launch_model(const launch_spec& spec)
 {
-    long handleProcess;
+    child_process child;
 
-    switch((handleProcess=fork())) {
-       case -1: {
-          std::cerr << "..Unable to start a new child process" << "\n";
-          return -1;      // Don't exit() here, return as this is the parent process.
-          break;
-       }
-       case 0: { // The child process
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(spec.exe.c_str()));
+    for (const auto& arg : spec.args) {
+       argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(NULL);
 
-           // Set the environment variables for the executable.
-           if ( !oifs_setenvs(slot_path, nthreads) ) {
-             std::cerr << "..Setting the OpenIFS environmental variables failed" << std::endl;
-             exit(1);   // Can't continue child process so exit to end child process.
-          }
+    std::vector<char*> envp;
+    for (const auto& var : spec.env) {
+       envp.push_back(const_cast<char*>(var.c_str()));
+    }
+    envp.push_back(NULL);
 
-          // --------------------------------------
-          // Custom environment variable overrides, if the override file exists.
-          // NOTE! This should only be used for testing and never advertised to users.
-          {
-            fs::path override_env_vars = project_path + "/oifs_override_env_vars";
-            process_env_overrides(override_env_vars);
-          }
-          //---------------------------------------
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (!spec.stdout_file.empty()) {
+       posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, spec.stdout_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
+    if (!spec.stderr_file.empty()) {
+       posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, spec.stderr_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
 
-          // Execute OpenIFS
-          // OpenIFS 40r1 requires the -e exptid argument, later versions do not.
-          // GC. TODO. This should be an input arg, not decided here.
+    // The model starts with default signal handling and nothing blocked, whatever the parent uses.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t all_signals, no_signals;
+    sigfillset(&all_signals);
+    sigemptyset(&no_signals);
+    posix_spawnattr_setsigdefault(&attr, &all_signals);
+    posix_spawnattr_setsigmask(&attr, &no_signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    std::vector<std::pair<int, struct rlimit>> saved_limits;
+    for (const auto& limit : spec.rlimits) {
+       struct rlimit current;
+       if (getrlimit(limit.first, &current) != 0) continue;
+       struct rlimit child_limit = current;
+       child_limit.rlim_cur = (current.rlim_max == RLIM_INFINITY) ? limit.second : std::min(limit.second, current.rlim_max);
+       if (setrlimit(limit.first, &child_limit) != 0) {
+          std::cerr << "..launch_model: setting resource limit " << limit.first << " failed: " << strerror(errno) << '\n';
+          continue;
+       }
+       saved_limits.emplace_back(limit.first, current);
+    }
 
-          if( (app_name == "openifs") || (app_name == "oifs_40r1")) { // OpenIFS 40r1
-            std::cerr << "Executing the command: " << strCmd << " -e " << exptid << "\n";
-            execl(strCmd.c_str(),strCmd.c_str(),"-e",exptid.c_str(),NULL);
-          }
-          else {  // OpenIFS 43r3 and above
-            std::cerr << "Executing the command: " << strCmd << "\n";
-            execl(strCmd.c_str(),strCmd.c_str(),NULL);         // always returns -1 on failure
-          }
+#if defined(__linux__)
+    cpu_set_t saved_mask;
+    bool restore_mask = false;
+    if (!spec.cpus.empty() && sched_getaffinity(0, sizeof(saved_mask), &saved_mask) == 0) {
+       cpu_set_t mask;
+       CPU_ZERO(&mask);
+       for (auto cpu : spec.cpus) CPU_SET(cpu, &mask);
+       if (sched_setaffinity(0, sizeof(mask), &mask) == 0) {
+          restore_mask = true;
+       }
+       else {
+          std::cerr << "..launch_model: setting the cpu affinity failed: " << strerror(errno) << '\n';
+       }
+    }
+#endif
 
-          // If execl returns there was an error
-          int syserr = errno;    // grab the error before any other system call.
-          const char* syserr_msg = strerror(syserr);
+    std::cerr << "Executing the command: " << spec.exe;
+    for (const auto& arg : spec.args) std::cerr << ' ' << arg;
+    std::cerr << std::endl;
 
-          std::cerr << "..Launch process failed: execl - errno = " << syserr << ", " << syserr_msg
-                     << "\n slot_path=" << slot_path << ",strCmd=" << strCmd << ",exptid=" << exptid << std::endl;
+    pid_t pid;
+    int err = posix_spawn(&pid, spec.exe.c_str(), &actions, &attr, argv.data(), envp.data());
 
-          exit(syserr);  // exit child process with system code for better remote diagnosis.
-          break;
-       }
-       default: 
-          std::cerr << "The child process has been launched with process id: " << handleProcess << "\n";
+    for (const auto& saved : saved_limits) {
+       setrlimit(saved.first, &saved.second);
     }
-    return handleProcess;
-}
-
+#if defined(__linux__)
+    if (restore_mask) {
+       sched_setaffinity(0, sizeof(saved_mask), &saved_mask);
+    }
+#endif
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
 
-long launch_process_wrf(const std::string slot_path, const char* strCmd) {
-    int retval = 0;
-    long handleProcess;
-
-    switch((handleProcess=fork())) {
-       case -1: {
-          std::cerr << "..Unable to start a new child process" << std::endl;
-          exit(0);
-          break;
-       }
-       case 0: { //The child process
-          std::cerr << "Executing the command: " << strCmd << "\n";
-          retval = execl(strCmd,strCmd,NULL,NULL,NULL);
-
-          // If execl returns then there was an error
-          if (retval) {
-             std::cerr << "..The execl() command failed slot_path=" << slot_path << ",strCmd=" << strCmd << std::endl;
-             exit(retval);
-             break;
-          }
-       }
-       default: 
-          std::cerr << "The child process has been launched with process id: " << handleProcess << std::endl;
+    if (err != 0) {
+       std::cerr << "..Launch process failed: posix_spawn - errno = " << err << ", " << strerror(err)
+                 << "\n exe=" << spec.exe << std::endl;
+       return child;
     }
-    return handleProcess;
-}
 
+    child.pid = pid;
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    // The pid can't be reused while it's an unreaped child, so the pidfd refers to the model.
+    child.pidfd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+    std::cerr << "The child process has been launched with process id: " << child.pid << "\n";
+    return child;
+}
 
 
 // Open a file and return the "jf_*" string contained between the arrow tags else empty string
@@ -483,65 +674,227 @@ std::string get_tag(const std::string &filename) {
 }
 
 
+// The progress file is a fixed size binary record, protected by a checksum and replaced atomically
+// (write temporary file + rename) so a crash can never leave it empty or half written.
+// Older tasks may still have the previous 'key=value' text format, which can be read but not written.
+namespace {
+    constexpr char     PROGRESS_MAGIC[4]    = {'C','P','D','N'};
+    constexpr uint32_t PROGRESS_VERSION     = 2;
+    constexpr double   PROGRESS_CPU_REWRITE = 60.0;   // cpu time alone only forces a rewrite this often (secs)
+
+    struct progress_record {
+        char     magic[4];
+        uint32_t version;
+        double   cpu_time;
+        int32_t  upload_file_number;
+        int32_t  last_iter;
+        int32_t  last_upload;
+        int32_t  model_completed;
+        uint32_t reserved;
+        uint32_t checksum;            // version 1 ends here. FNV-1a of all preceding bytes.
+        double   wall_per_step;       // version 2: progress estimate
+        double   cpu_per_step;
+        double   fraction_done;
+        uint32_t checksum2;           // FNV-1a of all preceding bytes
+        uint32_t reserved3;
+    };
+    constexpr size_t PROGRESS_V1_SIZE = offsetof(progress_record, wall_per_step);
+    static_assert(PROGRESS_V1_SIZE == 40 && sizeof(progress_record) == 72, "progress_record layout must not change, add a new version");
+
+    uint32_t progress_checksum(const progress_record& rec, size_t nbytes) {
+        auto bytes = reinterpret_cast<const unsigned char*>(&rec);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < nbytes; i++) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    bool progress_record_valid(const progress_record& rec, ssize_t nread) {
+        if (nread >= (ssize_t) PROGRESS_V1_SIZE && rec.version == 1) {
+           return rec.checksum == progress_checksum(rec, offsetof(progress_record, checksum));
+        }
+        if (nread == (ssize_t) sizeof(progress_record) && rec.version == 2) {
+           return rec.checksum2 == progress_checksum(rec, offsetof(progress_record, checksum2));
+        }
+        return false;
+    }
+
+    // Read the previous text format of the progress file
+    bool read_progress_text(const std::string& progress_file, double& last_cpu_time, int& upload_file_number,
+                            std::string& last_iter, int& last_upload, int& model_completed) {
+        std::string progress_line = "";
+        std::string delimiter = "=";
+        std::ifstream progress_filestream(progress_file);
+        bool found = false;
+
+        while(std::getline(progress_filestream, progress_line)) { //get 1 row as a string
+
+           if (progress_line.find("last_cpu_time") != std::string::npos) {
+              last_cpu_time = std::stod(progress_line.substr(progress_line.find(delimiter)+1, progress_line.length()-1));
+           }
+           else if (progress_line.find("upload_file_number") != std::string::npos) {
+              upload_file_number = std::stoi(progress_line.substr(progress_line.find(delimiter)+1, progress_line.length()-1));
+           }
+           else if (progress_line.find("last_iter") != std::string::npos) {
+              last_iter = progress_line.substr(progress_line.find(delimiter)+1, progress_line.length()-1);
+              found = true;
+           }
+           else if (progress_line.find("last_upload") != std::string::npos) {
+              last_upload = std::stoi(progress_line.substr(progress_line.find(delimiter)+1, progress_line.length()-1));
+           }
+           else if (progress_line.find("model_completed") != std::string::npos) {
+              model_completed = std::stoi(progress_line.substr(progress_line.find(delimiter)+1, progress_line.length()-1));
+           }
+        }
+        return found;
+    }
+}
+
+
 // Read the progress file
-void read_progress_file(std::string progress_file, int& last_cpu_time, int& upload_file_number, 
-                        std::string& last_iter, int& last_upload, int& model_completed) {
+// Returns false if the file can't be read or is corrupt.
+bool read_progress_file(std::string progress_file, double& last_cpu_time, int& upload_file_number, 
+                        std::string& last_iter, int& last_upload, int& model_completed, progress_estimate* estimate) {
 
-    // Parse the progress_file
-    std::string progress_line = "";
-    std::string delimiter = "=";
-    std::ifstream progress_filestream;
-    
-    // Open the progress_file file
-    if(!(progress_filestream.is_open())) {
-       progress_filestream.open(progress_file);
-    } 
-    
-    // Read the namelist file
-    while(std::getline(progress_filestream, progress_line)) { //get 1 row as a string
+    progress_record rec;
+    memset(&rec, 0, sizeof(rec));
+    ssize_t nread = -1;
 
-       if (progress_line.find("last_cpu_time") != std::string::npos) {
-          last_cpu_time = std::stoi(progress_line.substr(progress_line.find(delimiter)+1, progress_line.length()-1));
-       }
-       else if (progress_line.find("upload_file_number") != std::string::npos) {
-          upload_file_number = std::stoi(progress_line.substr(progress_line.find(delimiter)+1, progress_line.length()-1));
-       }
-       else if (progress_line.find("last_iter") != std::string::npos) {
-          last_iter = progress_line.substr(progress_line.find(delimiter)+1, progress_line.length()-1);
-       }
-       else if (progress_line.find("last_upload") != std::string::npos) {
-          last_upload = std::stoi(progress_line.substr(progress_line.find(delimiter)+1, progress_line.length()-1));
+    int fd = open(progress_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+       std::cerr << "..read_progress_file: unable to open: " << progress_file << ", error: " << strerror(errno) << '\n';
+       return false;
+    }
+    nread = pread(fd, &rec, sizeof(rec), 0);
+    close(fd);
+
+    // Anything not starting with the magic number is from an older version of the control code.
+    if ( nread < (ssize_t) sizeof(rec.magic) || memcmp(rec.magic, PROGRESS_MAGIC, sizeof(rec.magic)) != 0 ) {
+       try {
+          return read_progress_text(progress_file, last_cpu_time, upload_file_number, last_iter, last_upload, model_completed);
        }
-       else if (progress_line.find("model_completed") != std::string::npos) {
-          model_completed = std::stoi(progress_line.substr(progress_line.find(delimiter)+1, progress_line.length()-1));
+       catch (const std::exception& e) {
+          std::cerr << "..read_progress_file: unable to parse: " << progress_file << ", error: " << e.what() << '\n';
+          return false;
        }
     }
-    progress_filestream.close();
+
+    if ( rec.version < 1 || rec.version > PROGRESS_VERSION ) {
+       std::cerr << "..read_progress_file: unknown progress file version: " << rec.version << '\n';
+       return false;
+    }
+    if ( !progress_record_valid(rec, nread) ) {
+       std::cerr << "..read_progress_file: progress file is corrupt: " << progress_file << '\n';
+       return false;
+    }
+
+    last_cpu_time      = rec.cpu_time;
+    upload_file_number = rec.upload_file_number;
+    last_iter          = std::to_string(rec.last_iter);
+    last_upload        = rec.last_upload;
+    model_completed    = rec.model_completed;
+    if ( estimate && rec.version >= 2 ) {
+       estimate->wall_per_step = rec.wall_per_step;
+       estimate->cpu_per_step  = rec.cpu_per_step;
+       estimate->fraction_done = rec.fraction_done;
+    }
+    return true;
 }
 
 
-// Update the progress file
-void update_progress_file(std::string progress_file, int last_cpu_time, int upload_file_number,
-                          std::string last_iter, int last_upload, int model_completed)
+// Update the progress file, only if something other than the cpu time has changed
+// (or the cpu time has moved on by more than PROGRESS_CPU_REWRITE).
+void update_progress_file(std::string progress_file, double last_cpu_time, int upload_file_number,
+                          std::string last_iter, int last_upload, int model_completed, const progress_estimate& estimate)
 {
-    std::ofstream progress_file_out(progress_file);
+    static std::string     last_file;
+    static progress_record last_rec;
+
+    progress_record rec;
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.magic, PROGRESS_MAGIC, sizeof(rec.magic));
+    rec.version            = PROGRESS_VERSION;
+    rec.cpu_time           = last_cpu_time;
+    rec.upload_file_number = upload_file_number;
+    rec.last_iter          = (int32_t) strtol(last_iter.c_str(), NULL, 10);
+    rec.last_upload        = last_upload;
+    rec.model_completed    = model_completed;
+    rec.checksum           = progress_checksum(rec, offsetof(progress_record, checksum));
+    rec.wall_per_step      = estimate.wall_per_step;
+    rec.cpu_per_step       = estimate.cpu_per_step;
+    rec.fraction_done      = estimate.fraction_done;
+    rec.checksum2          = progress_checksum(rec, offsetof(progress_record, checksum2));
+
+    if ( progress_file == last_file &&
+         rec.upload_file_number == last_rec.upload_file_number && rec.last_iter == last_rec.last_iter &&
+         rec.last_upload == last_rec.last_upload && rec.model_completed == last_rec.model_completed &&
+         rec.wall_per_step == last_rec.wall_per_step && rec.cpu_per_step == last_rec.cpu_per_step &&
+         fabs(rec.cpu_time - last_rec.cpu_time) < PROGRESS_CPU_REWRITE ) {
+       return;
+    }
 
-    // Write out the new progress file. Note this truncates progress_file to zero bytes if it already exists (as in a model restart)
-    progress_file_out << "last_cpu_time=" << std::to_string(last_cpu_time) << '\n';
-    progress_file_out << "upload_file_number=" << std::to_string(upload_file_number) << '\n';
-    progress_file_out << "last_iter=" << last_iter << '\n';
-    progress_file_out << "last_upload=" << std::to_string(last_upload) << '\n';
-    progress_file_out << "model_completed="<< std::to_string(model_completed) << std::endl;
-    progress_file_out.close();
+    // Write the complete record to a temporary file and rename it over the progress file.
+    std::string tmp_file = progress_file + ".tmp";
+    int fd = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+       std::cerr << "..update_progress_file: unable to create: " << tmp_file << ", error: " << strerror(errno) << '\n';
+       return;
+    }
+    bool ok = ( pwrite(fd, &rec, sizeof(rec), 0) == (ssize_t) sizeof(rec) ) && ( fdatasync(fd) == 0 );
+    close(fd);
+
+    if ( !ok || rename(tmp_file.c_str(), progress_file.c_str()) != 0 ) {
+       std::cerr << "..update_progress_file: unable to write: " << progress_file << ", error: " << strerror(errno) << '\n';
+       unlink(tmp_file.c_str());
+       return;
+    }
+    last_file = progress_file;
+    last_rec  = rec;
+}
+
+
+// Print the content of the progress file to stderr, to help diagnose a failed task
+void print_progress_file(const std::string& progress_file) {
+    std::string last_iter;
+    double last_cpu_time = 0;
+    int upload_file_number = 0, last_upload = 0, model_completed = 0;
+
+    if ( read_progress_file(progress_file, last_cpu_time, upload_file_number, last_iter, last_upload, model_completed) ) {
+       std::cerr << ">>> Progress file: " << progress_file << '\n'
+                 << "last_cpu_time=" << last_cpu_time << '\n'
+                 << "upload_file_number=" << upload_file_number << '\n'
+                 << "last_iter=" << last_iter << '\n'
+                 << "last_upload=" << last_upload << '\n'
+                 << "model_completed=" << model_completed << '\n'
+                 << "------------------------------------------------" << '\n';
+    }
 }
 
 
+// The task performance block of the trickle, after the original fields so existing trickle parsers still work.
+std::string trickle_perf_block(const task_perf& perf) {
+    std::stringstream block;
+    block << std::setprecision(4)
+          << "<perf><wall_step>" << perf.wall_per_step << "</wall_step><cpu_step>" << perf.cpu_per_step
+          << "</cpu_step><cpu_eff>" << perf.cpu_efficiency << "</cpu_eff><zip_mbs>" << perf.zip_mb_per_sec
+          << "</zip_mbs><zip_ratio>" << perf.zip_ratio << "</zip_ratio><staged>" << perf.staged_bytes
+          << "</staged><uploaded>" << perf.uploaded_bytes << "</uploaded><suspended>" << perf.suspended_secs
+          << "</suspended><slowdowns>" << perf.slowdowns << "</slowdowns><remaining>" << std::lround(perf.remaining_secs)
+          << "</remaining><peak_rss>" << perf.peak_rss << "</peak_rss></perf>\n";
+    return block.str();
+}
+
 // Produce the trickle and either upload to the project server or as a physical file
-void process_trickle(double current_cpu_time, std::string wu_name, std::string result_base_name, std::string slot_path, int timestep, int standalone) 
+void process_trickle(double current_cpu_time, std::string wu_name, std::string result_base_name, std::string slot_path, int timestep, int standalone,
+                     const task_perf* perf)
 {
     std::stringstream trickle_buffer;
     trickle_buffer << "<wu>" << wu_name << "</wu>\n<result>" << result_base_name << "</result>\n<ph></ph>\n<ts>" \
                    << timestep << "</ts>\n<cp>" << current_cpu_time << "</cp>\n<vr></vr>\n";
+    if (perf != nullptr) {
+       trickle_buffer << trickle_perf_block(*perf);
+    }
     std::string trickle = trickle_buffer.str();
 
     // Create null terminated, non-const char buffers for the boinc_send_trickle_up call
@@ -562,12 +915,73 @@ void process_trickle(double current_cpu_time, std::string wu_name, std::string r
 
        FILE* trickle_file = fopen(trickle_location.c_str(), "w");
        if (trickle_file) {
-          std::fwrite(trickle_data.data(), sizeof(trickle_data.data()), 1, trickle_file);
+          std::fwrite(trickle.data(), 1, trickle.size(), trickle_file);
           fclose(trickle_file);
        }
     }
 }
 
+// Tell the BOINC client to upload 'upload_file_name' now rather than at the end of the task,
+// and start tracking its status. The upload file must be complete and flushed to disk.
+int start_upload(const std::string& upload_file_name, std::vector<upload_status>& uploads) {
+    std::string name = upload_file_name;       // boinc_upload_file takes a non-const reference
+
+    int retval = boinc_upload_file(name);
+    if (retval) {
+       std::cerr << "..boinc_upload_file failed for file: " << upload_file_name << std::endl;
+       return retval;
+    }
+    uploads.push_back( { upload_file_name, chrono::steady_clock::now() + chrono::seconds(UPLOAD_CHECK_MIN), UPLOAD_CHECK_MIN, trace_now_us() } );
+    return 0;
+}
+
+
+// Check the status of tracked uploads without blocking, dropping any that have finished.
+// Each upload is checked with exponential backoff as uploads take minutes to hours.
+void poll_upload_status(std::vector<upload_status>& uploads, bool force) {
+    auto now = chrono::steady_clock::now();
+
+    for (auto it = uploads.begin(); it != uploads.end(); ) {
+       if (!force && now < it->next_check) {
+          ++it;
+          continue;
+       }
+       int status = boinc_upload_status(it->name);
+       if (status == ERR_NOT_FOUND) {           // client hasn't reported on it yet
+          it->interval   = std::min(it->interval * 2, UPLOAD_CHECK_MAX);
+          it->next_check = now + chrono::seconds(it->interval);
+          ++it;
+          continue;
+       }
+       // The upload finished some time since the last check.
+       trace_complete("upload file", "upload", it->started_us, trace_now_us() - it->started_us);
+       if (status == 0) {
+          std::cerr << "Finished the upload of file: " << it->name << '\n';
+       } else {
+          std::cerr << "..Upload of file: " << it->name << " failed with status: " << status << " (the client will retry at task end)\n";
+       }
+       it = uploads.erase(it);
+    }
+}
+
+
+// Wait up to max_wait secs, with backoff, for tracked uploads to finish.
+void wait_upload_status(std::vector<upload_status>& uploads, int max_wait) {
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(max_wait);
+    auto interval = chrono::seconds(1);
+
+    poll_upload_status(uploads, true);
+    while (!uploads.empty() && chrono::steady_clock::now() + interval <= deadline) {
+       std::this_thread::sleep_for(interval);
+       interval = std::min(interval * 2, chrono::seconds(UPLOAD_CHECK_MAX));
+       poll_upload_status(uploads, true);
+    }
+    for (const auto& upload : uploads) {
+       std::cerr << "Upload of file: " << upload.name << " still in progress\n";
+    }
+}
+
+
 // Check whether a file exists
 bool file_exists(const std::string& filename) {
     std::ifstream infile(filename.c_str());
@@ -575,6 +989,22 @@ bool file_exists(const std::string& filename) {
 }
 
 
+// Flush a file we've written to disk. Returns false on failure.
+bool fsync_file(const std::string& fpath) {
+    int fd = open(fpath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+       std::cerr << "..fsync_file: unable to open: " << fpath << ", error: " << strerror(errno) << '\n';
+       return false;
+    }
+    bool ok = (fsync(fd) == 0);
+    if (!ok) {
+       std::cerr << "..fsync_file: fsync failed for: " << fpath << ", error: " << strerror(errno) << '\n';
+    }
+    close(fd);
+    return ok;
+}
+
+
 // Check whether file is zero bytes long
 // from: https://stackoverflow.com/questions/2390912/checking-for-an-empty-file-in-c
 // returns True if file is zero bytes, otherwise False.
@@ -606,54 +1036,61 @@ double cpu_time(long handleProcess) {
 }
 
 
-// returns fraction completed of model run
+// Estimates the fraction of the model run completed, for the BOINC client progress bar.
+// The client derives its estimate of the time remaining from the fraction done, so interpolating
+// between model steps (which can take minutes) at the measured step rate improves both.
 // (candidate for moving into OpenIFS specific src file)
-double model_frac_done(double step, double total_steps, int nthreads ) {
-   static int     stepm1 = -1;
-   static double  heartbeat = 0.0;
-   static bool    debug = false;
-   double         frac_done, frac_per_step;
-   double         heartbeat_inc;
-
-   frac_done     = step / total_steps;	// this increments slowly, as a model step is ~30sec->2mins cpu
-   frac_per_step = 1.0 / total_steps;
-   
-   if (debug) {
-      fprintf( stderr,"get_frac_done: step = %.0f\n", step);
-      fprintf( stderr,"        total_steps = %.0f\n", total_steps );
-      fprintf( stderr,"      frac_per_step = %f\n",   frac_per_step );
-   }
-   
-   // Constant below represents estimate of how many times around the mainloop
-   // before the model completes it's next step. This varies alot depending on model
-   // resolution, computer speed, etc. Tune it looking at varied runtimes & resolutions!
-   // Higher is better than lower to underestimate.
-   // 
-   // Impact of speedup due to multiple threads is accounted for below.
-   //
-   // If we want more accuracy could use the ratio of the model timestep to 1h (T159 tstep) to 
-   // provide a 'slowdown' factor for higher resolutions.
-   heartbeat_inc = (frac_per_step / (70.0 / (double)nthreads) );
-
-   if ( (int) step > stepm1 ) {
-      heartbeat = 0.0;
-      stepm1 = (int) step;
-   } else {
-      heartbeat = heartbeat + heartbeat_inc;
-      if ( heartbeat > frac_per_step )  heartbeat = frac_per_step - 0.001;  // slightly less than the next step
-      frac_done = frac_done + heartbeat;
-   } 
-
-   if (frac_done < 0.0)  frac_done = 0.0;
-   if (frac_done > 1.0)  frac_done = 0.9999; // never 100% until wrapper finishes
-   if (debug){
-      fprintf(stderr, "    heartbeat_inc = %.8f\n", heartbeat_inc);
-      fprintf(stderr, "    heartbeat     = %.8f\n", heartbeat );
-      double percent = frac_done * 100.0;
-      fprintf(stderr, "     percent done = %.3f\n", percent);
-   }
+ProgressEstimator::ProgressEstimator(int total_steps, const progress_estimate& estimate)
+    : total_steps_(std::max(total_steps, 1)), estimate_(estimate)
+{
+}
+
+
+// Update with the model step in progress and the model's total cpu time; call once per main loop.
+void ProgressEstimator::update(int step, double cpu_time, chrono::steady_clock::time_point now) {
+
+    if (step != last_step_) {
+       // Don't include the model start up (reading input files) or restarts in the step rate.
+       if (have_reference_ && step > last_step_) {
+          double nsteps   = (double) (step - last_step_);
+          double wall     = chrono::duration<double>(now - last_step_time_).count() / nsteps;
+          double cpu      = (cpu_time - last_step_cpu_) / nsteps;
+          double weight   = 1.0 - std::pow(1.0 - EWMA_WEIGHT, nsteps);
+
+          if (estimate_.wall_per_step <= 0.0) {
+             estimate_.wall_per_step = wall;
+             estimate_.cpu_per_step  = cpu;
+          } else {
+             estimate_.wall_per_step += weight * (wall - estimate_.wall_per_step);
+             estimate_.cpu_per_step  += weight * (cpu  - estimate_.cpu_per_step);
+          }
+       }
+       have_reference_ = last_step_ >= 0 && step > last_step_;
+       last_step_      = step;
+       last_step_time_ = now;
+       last_step_cpu_  = cpu_time;
+    }
+
+    // Interpolate within the current step, but never reach the next one.
+    double partial = 0.0;
+    if (estimate_.wall_per_step > 0.0) {
+       partial = chrono::duration<double>(now - last_step_time_).count() / estimate_.wall_per_step;
+       partial = std::min(partial, 0.99);
+    }
+    steps_done_ = std::min(last_step_ + partial, (double) total_steps_);
 
-   return frac_done;
+    // Never go backwards and never 100% until the control code finishes.
+    double frac_done = std::min(steps_done_ / total_steps_, 0.9999);
+    estimate_.fraction_done = std::max(estimate_.fraction_done, frac_done);
+}
+
+
+// Estimated wall time in secs to the end of the model run, or -1 if not yet known.
+double ProgressEstimator::time_remaining() const {
+    if (estimate_.wall_per_step <= 0.0) {
+       return -1.0;
+    }
+    return (total_steps_ - steps_done_) * estimate_.wall_per_step;
 }
 
 
@@ -666,8 +1103,132 @@ std::string get_second_part(const std::string& last_iter, const std::string& exp
 }
 
 
+// Name of the method used by move_file(), for diagnostics
+const char* move_method_name(MoveMethod method) {
+    switch (method) {
+       case MoveMethod::Rename:    return "rename";
+       case MoveMethod::Reflink:   return "reflink";
+       case MoveMethod::CopyRange: return "copy";
+       default:                    return "failed";
+    }
+}
+
+
+/**
+ * @brief Moves a file, avoiding a full data copy wherever the filesystem allows it.
+ *
+ * Tries, in order:
+ *   rename(2)        : the slot and project directories are normally on the same filesystem,
+ *   ioctl(FICLONE)   : reflink (shared extents) on btrfs/xfs when the directories are on different mounts,
+ *   copy_file_range  : in-kernel copy, falling back to read/write if the kernel refuses it.
+ * Copies are fsync'd before the source is unlinked so a crash never loses the only copy.
+ *
+ * @param source      File to move.
+ * @param destination Destination path, overwritten if it exists.
+ * @return The method used, MoveMethod::Failed on error (source is left in place).
+ */
+MoveMethod move_file(const std::string& source, const std::string& destination) {
+
+    if (rename(source.c_str(), destination.c_str()) == 0) {
+       return MoveMethod::Rename;
+    }
+    if (errno != EXDEV) {
+       std::cerr << "..move_file: rename failed for: " << source << ", error: " << strerror(errno) << '\n';
+       return MoveMethod::Failed;
+    }
+
+    // Different filesystems, need to copy the data.
+    int src_fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src_fd < 0) {
+       std::cerr << "..move_file: unable to open: " << source << ", error: " << strerror(errno) << '\n';
+       return MoveMethod::Failed;
+    }
+
+    struct stat src_stat;
+    if (fstat(src_fd, &src_stat) != 0) {
+       std::cerr << "..move_file: unable to stat: " << source << ", error: " << strerror(errno) << '\n';
+       close(src_fd);
+       return MoveMethod::Failed;
+    }
+
+    int dest_fd = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, src_stat.st_mode & 0777);
+    if (dest_fd < 0) {
+       std::cerr << "..move_file: unable to create: " << destination << ", error: " << strerror(errno) << '\n';
+       close(src_fd);
+       return MoveMethod::Failed;
+    }
+
+    MoveMethod method = MoveMethod::Failed;
+
+#if defined(__linux__)
+    if (ioctl(dest_fd, FICLONE, src_fd) == 0) {
+       method = MoveMethod::Reflink;
+    }
+#endif
+
+    if (method == MoveMethod::Failed) {
+       off_t remaining = src_stat.st_size;
+       bool  use_copy_range = true;
+       std::vector<char> buffer;
+
+       while (remaining > 0) {
+          ssize_t nbytes = -1;
+#if defined(__linux__)
+          if (use_copy_range) {
+             nbytes = copy_file_range(src_fd, NULL, dest_fd, NULL, remaining, 0);
+             if (nbytes < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                use_copy_range = false;     // older kernel or filesystem, fall back to read/write below
+             }
+          }
+#else
+          use_copy_range = false;
+#endif
+          if (!use_copy_range) {
+             if (buffer.empty()) buffer.resize(1 << 20);
+             nbytes = read(src_fd, buffer.data(), buffer.size());
+             ssize_t written = 0;
+             while (nbytes > 0 && written < nbytes) {
+                ssize_t n = write(dest_fd, buffer.data() + written, nbytes - written);
+                if (n < 0) {
+                   if (errno == EINTR) continue;
+                   nbytes = -1;
+                   break;
+                }
+                written += n;
+             }
+          }
+          if (nbytes < 0) {
+             if (errno == EINTR) continue;
+             break;
+          }
+          if (nbytes == 0) break;          // source shrank underneath us
+          remaining -= nbytes;
+       }
+       if (remaining == 0) method = MoveMethod::CopyRange;
+    }
+
+    if (method != MoveMethod::Failed && fsync(dest_fd) != 0) {
+       method = MoveMethod::Failed;
+    }
+    if (method == MoveMethod::Failed) {
+       std::cerr << "..move_file: copying " << source << " to " << destination << " failed, error: " << strerror(errno) << '\n';
+    }
+    close(src_fd);
+    close(dest_fd);
+
+    if (method == MoveMethod::Failed) {
+       unlink(destination.c_str());
+       return method;
+    }
+
+    if (unlink(source.c_str()) != 0) {
+       std::cerr << "..move_file: Error removing file: " << source << ", error: " << strerror(errno) << '\n';
+    }
+    return method;
+}
+
+
 int move_result_file(std::string slot_path, std::string temp_path, std::string first_part, std::string second_part) {
-    int retval = 0;
 
     // Move result file to the temporary folder in the project directory
     std::string result_file = slot_path + "/" + first_part + second_part;
@@ -675,19 +1236,65 @@ int move_result_file(std::string slot_path, std::string temp_path, std::string f
     //std::cerr << "Checking for result file: " << result_file << "\n";
 
     if(file_exists(result_file)) {
-       std::cerr << "Moving result file: " <<  fs::path(result_file).filename() << " to projects directory.\n";
-       retval = boinc_copy( result_file.c_str(), temp_file.c_str() );
+       MoveMethod method = move_file(result_file, temp_file);
+       if (method == MoveMethod::Failed) {
+          return 1;
+       }
+       std::cerr << "Moved result file: " <<  fs::path(result_file).filename() << " to projects directory (" << move_method_name(method) << ").\n";
+    }
+    return 0;
+}
 
-       // If result file has been successfully copied over, remove it from slots directory
-       if (!retval) {
-          try {
-               fs::remove(result_file);
-          } catch (const  fs::filesystem_error& e) {
-              std::cerr << "..move_result_file(). Error removing file: " << result_file << ", error: " << e.what() << "\n";
-          }
+
+/**
+ * @brief Moves all ICMGG, ICMSH & ICMUA model output files for experiment 'exptid'
+ *        from the slot to the temp folder with a single scan of the slot directory.
+ *        Used to catch up on output left behind by an interrupted run and at the end of the run.
+ * @return Number of files moved, or -1 if a move failed.
+ */
+int move_result_files(const std::string& slot_path, const std::string& temp_path, const std::string& exptid) {
+    int nmoved = 0;
+    std::error_code ec;
+
+    for (const auto& entry : fs::directory_iterator(slot_path, ec)) {
+       const std::string fname = entry.path().filename().string();
+
+       if (fname.size() <= 5 + exptid.size() + 1 || fname.compare(5, exptid.size() + 1, exptid + "+") != 0) continue;
+       if (fname.compare(0, 5, "ICMGG") != 0 && fname.compare(0, 5, "ICMSH") != 0 && fname.compare(0, 5, "ICMUA") != 0) continue;
+
+       if (move_result_file(slot_path, temp_path, fname.substr(0, 5), fname.substr(5))) {
+          return -1;
        }
+       nmoved++;
     }
-    return retval;
+    if (ec) {
+       std::cerr << "..move_result_files: unable to read directory: " << slot_path << ", error: " << ec.message() << '\n';
+    }
+    return nmoved;
+}
+
+
+/**
+ * @brief Returns the model steps at which output (ICM) files are written, in increasing order.
+ *        NFRPOS is in model steps if positive, hours if negative (converted to steps as for NFRRES).
+ *        If NFRPOS is zero or can't be converted, every step is treated as an output step.
+ */
+std::vector<int> oifs_output_steps(int nfrpos, int timestep, int nsteps) {
+    int interval = nfrpos;
+
+    if ( interval < 0 && timestep > 0 ) {
+       interval = abs(interval)*3600 / timestep;
+    }
+    if ( interval <= 0 ) {
+       interval = 1;
+    }
+
+    std::vector<int> output_steps;
+    output_steps.reserve(nsteps / interval + 2);
+    for (int step = 0; step <= nsteps; step += interval) {
+       output_steps.push_back(step);
+    }
+    return output_steps;
 }
 
 
@@ -813,32 +1420,69 @@ bool oifs_valid_step(std::string& step, int nsteps) {
 }
 
 
+int read_last_lines(const std::string& filename, int maxlines, std::string& lines) {
+   // Reads the last maxlines lines of a file into 'lines', without the final newline. The file is read
+   // in blocks backwards from the end until enough lines are found, so the cost depends on the size
+   // of the lines read, not the file.
+   // Returns: zero : either can't open file, file is empty or maxlines < 1
+   //          > 0  : no. of lines read (may be less than maxlines)
+   constexpr off_t CHUNK_SIZE = 64 * 1024;
+   lines.clear();
+   if (maxlines < 1) return 0;
+
+   int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) return 0;
+
+   struct stat st {};
+   off_t end = (fstat(fd, &st) == 0) ? st.st_size : 0;
+   off_t start = 0;
+   int   newlines = 0;
+   char  last;
+   if (end > 0 && pread(fd, &last, 1, end - 1) == 1 && last == '\n') end--;     // the final newline ends the last line
+
+   // Look for the newline before the first line wanted.
+   std::vector<char> chunk(CHUNK_SIZE);
+   for (off_t pos = end; pos > 0 && start == 0; ) {
+      off_t offset = std::max<off_t>(pos - CHUNK_SIZE, 0);
+      ssize_t nbytes = pread(fd, chunk.data(), pos - offset, offset);
+      if (nbytes != pos - offset) {
+         close(fd);
+         return 0;
+      }
+      for (off_t i = nbytes - 1; i >= 0; i--) {
+         if (chunk[i] == '\n' && ++newlines == maxlines) {
+            start = offset + i + 1;
+            break;
+         }
+      }
+      pos = offset;
+   }
+
+   lines.resize(end - start);
+   bool ok = st.st_size > 0;                 // a file of just a newline is one empty line
+   if (pread(fd, lines.data(), lines.size(), start) != (ssize_t) lines.size()) {
+      lines.clear();
+      ok = false;
+   }
+   close(fd);
+   return ok ? std::min(newlines + 1, maxlines) : 0;
+}
+
+
 int print_last_lines(std::string filename, int maxlines) {
-   // Opens a file if exists and uses circular buffer to read & print last lines of file to stderr.
+   // Print the last maxlines lines of a file to stderr, if it exists, in a single write.
    // Returns: zero : either can't open file or file is empty
-   //          > 0  : no. of lines in file (may be less than maxlines)
+   //          > 0  : no. of lines printed (may be less than maxlines)
    //  Glenn
 
-   int     count = 0;
-   int     start, end;
-   std::string  lines[maxlines];
-   std::ifstream filein(filename);
-
-   if ( filein.is_open() ) {
-      while ( getline(filein, lines[count%maxlines]) )
-         count++;
-   }
+   std::string lines;
+   int count = read_last_lines(filename, maxlines, lines);
 
    if ( count > 0 ) {
-      // find the oldest lines first in the buffer, will not be at start if count > maxlines
-      start = count > maxlines ? (count%maxlines) : 0;
-      end   = std::min(maxlines,count);
-
-      std::cerr << ">>> Printing last " << end << " lines from file: " << filename << '\n';
-      for ( int i=0; i<end; i++ ) {
-         std::cerr << lines[ (start+i)%maxlines ] << '\n';
-      }
-      std::cerr << "------------------------------------------------" << '\n';
+      std::string out = ">>> Printing last " + std::to_string(count) + " lines from file: " + filename + '\n'
+                        + lines + "\n------------------------------------------------\n";
+      std::cerr.write(out.data(), out.size());
+      std::cerr.flush();
    }
 
    return count;
@@ -941,7 +1585,8 @@ bool extract_key_value( const std::string& line, const std::string& key, char de
 
 // Takes the zip file, checks existence and whether empty and copies it to destination and unzips it
 // GC. TODO. Convert this to accept  fs::path args.
-int copy_and_unzip(const std::string& zipfile, const std::string& destination, const std::string& unzip_path, const std::string& type) {
+int copy_and_unzip(const std::string& zipfile, const std::string& destination, const std::string& unzip_path, const std::string& type,
+                   const cpdn_zip_control* control) {
     int retval = 0;
 
     // Check for the existence of the zip file
@@ -959,17 +1604,30 @@ int copy_and_unzip(const std::string& zipfile, const std::string& destination, c
     // Get the name of the 'jf_' filename from a link within the 'zipfile' file
     std::string source = get_tag(zipfile);
 
+    // The zip file is only consumed (deleted as it's unzipped) if it's a copy made now, so it can be copied
+    // again on a restart. If the copy would overwrite the file with the tag, it's made under another name.
+    std::string copy = destination;
+    cpdn_zip_control consume_control;
+    if (control != nullptr && control->consume_archive) {
+       consume_control = *control;
+       consume_control.consume_archive = !source.empty();
+       control = &consume_control;
+       if (consume_control.consume_archive && destination == zipfile) {
+          copy = destination + ".copy";
+       }
+    }
+
     // Copy and unzip the zip file only if the zip file contains a string between tags.
     // If it doesn't, the real zip file is likely already in the working directory from a previous run.
     if ( !source.empty() ) {
        // Copy the 'jf_' file to the working directory and rename
        if ( file_exists(source) ) {
-          std::cerr << "Copying the " << type << " file from: " << source << " to: " << destination << '\n';
+          std::cerr << "Copying the " << type << " file from: " << source << " to: " << copy << '\n';
           try {
-              fs::copy_file(source, destination,  fs::copy_options::overwrite_existing);
+              fs::copy_file(source, copy,  fs::copy_options::overwrite_existing);
           } 
           catch (const  fs::filesystem_error& e) {
-             std::cerr << "..copy_and_unzip: Error copying file: " << source << " to: " << destination << ",\nError: " << e.what() << "\n";
+             std::cerr << "..copy_and_unzip: Error copying file: " << source << " to: " << copy << ",\nError: " << e.what() << "\n";
              return 1;
           }
        }
@@ -981,15 +1639,21 @@ int copy_and_unzip(const std::string& zipfile, const std::string& destination, c
 
     // If 'source' is empty, the 'jf_' link wasn't there so we assume the real zip file is already in the working directory.
     // We could assume that the real zip file has already been unzipped, but to be safe unzip it if found.
-    if (file_exists(destination) ) {
-       std::cerr << "Unzipping the " << type << " zip file: " << destination << '\n';
-       if (!cpdn_unzip(destination, unzip_path)) {
+    if (file_exists(copy) ) {
+       std::cerr << "Unzipping the " << type << " zip file: " << copy << '\n';
+       std::atomic<bool> cancel(false);
+       cpdn_zip_control boinc_control;
+       if (control == nullptr) {
+          boinc_control = boinc_zip_control(type, cancel);
+          control = &boinc_control;
+       }
+       if (!cpdn_unzip(copy, unzip_path, control)) {
          std::cerr << "..Unzipping the " << type << " file failed" << std::endl;
          return 1;
        }
     }
     else {
-       std::cerr << "..The " << type << " file does not exist in the working directory: " << destination << std::endl;
+       std::cerr << "..The " << type << " file does not exist in the working directory: " << copy << std::endl;
        return 1;
     }
 
@@ -997,4 +1661,77 @@ int copy_and_unzip(const std::string& zipfile, const std::string& destination, c
     return retval;
 }
 
+// Copy and unzip several input files at once, each on its own thread. They must unzip to different files.
+// The BOINC client is serviced from this (the main) thread: the unzips are paused while the task is
+// suspended and all are stopped on a quit or abort request. With low_disk the zip file copies are
+// deleted as they are unzipped. The unzipped size of all the files is added to staged_bytes, if given.
+// Returns the number of jobs that failed, after all have finished.
+int copy_and_unzip_concurrent(const std::vector<unzip_job>& jobs, bool write_behind, bool low_disk, std::uint64_t* staged_bytes) {
+    std::atomic<bool> cancel(false);
+    std::atomic<bool> paused(false);
+    std::vector<int>  retvals(jobs.size(), 1);
+    std::vector<std::uint64_t> unzipped(jobs.size(), 0);
+    std::vector<std::thread> threads;
+    std::atomic<size_t> running(jobs.size());
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+       threads.emplace_back([&, i] {
+          const unzip_job& job = jobs[i];
+          cpdn_zip_control control;
+          control.cancel = &cancel;
+          control.write_behind = write_behind;
+          control.consume_archive = low_disk;
+          control.progress = [&, i, logged = -1](std::uint64_t done, std::uint64_t total) mutable {
+             unzipped[i] = done;
+             int percent = (total > 0) ? (int) (done * 100 / total) : 100;
+             if (total >= 64 * 1024 * 1024 && percent / 10 > logged) {
+                logged = percent / 10;
+                std::cerr << (job.type + ": " + std::to_string(percent) + "% done\n");
+             }
+             while (paused && !cancel) {
+                std::this_thread::sleep_for(chrono::milliseconds(200));
+             }
+          };
+          ScopedTimer timer(job.type, "staging");
+          retvals[i] = copy_and_unzip(job.zipfile, job.destination, job.unzip_path, job.type, &control);
+          std::cerr << (job.type + " staged in " + std::to_string(timer.elapsed_ms()) + " ms\n");
+          running--;
+       });
+    }
+
+    BOINC_STATUS status;
+    while (running > 0) {
+       std::this_thread::sleep_for(chrono::milliseconds(200));
+       boinc_get_status(&status);
+       if ((status.quit_request || status.abort_request || status.no_heartbeat) && !cancel) {
+          std::cerr << "Quit or abort request received from the BOINC client, stopping unzipping the input files\n";
+          cancel = true;
+       }
+       if ((status.suspended != 0) != paused) {
+          std::cerr << (status.suspended ? "Suspend request received from the BOINC client, pausing unzipping the input files\n"
+                                         : "Resuming unzipping the input files\n");
+          paused = (status.suspended != 0);
+       }
+    }
+    for (auto& thread : threads) {
+       thread.join();
+    }
+
+    for (auto bytes : unzipped) {
+       if (staged_bytes != nullptr) *staged_bytes += bytes;
+    }
+
+    int nfailed = 0;
+    std::string failed;
+    for (size_t i = 0; i < jobs.size(); i++) {
+       if (retvals[i] != 0) {
+          failed += (nfailed++ ? ", " : "") + jobs[i].type;
+       }
+    }
+    if (nfailed > 0) {
+       std::cerr << "..Copying and unzipping failed for: " << failed << std::endl;
+    }
+    return nfailed;
+}
+
 
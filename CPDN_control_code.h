@@ -8,6 +8,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <chrono>
 #include <thread>
 #include <fstream>
@@ -16,9 +17,16 @@
 #include <filesystem>
 #include <exception>
 #include <algorithm>
+#include <functional>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
@@ -28,42 +36,152 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sched.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 #include "boinc/boinc_api.h"
 #include "boinc/diagnostics.h"
 #include "boinc/util.h"
+#include "boinc/error_numbers.h"
 #include "rapidxml.hpp"
 #include "zip/cpdn_zip.h"
 
 
+// How move_file() moved the data; see move_file().
+enum class MoveMethod { Failed, Rename, Reflink, CopyRange };
+
+// Model step rate and progress, saved in the progress file so the estimate survives restarts.
+struct progress_estimate {
+    double wall_per_step = 0.0;     // EWMA of wall secs per model step
+    double cpu_per_step  = 0.0;     // EWMA of cpu secs per model step
+    double fraction_done = 0.0;     // fraction of the model run done, as reported to the client
+};
+
+// Estimates the fraction done and time remaining of the model run from the measured step rate.
+class ProgressEstimator {
+  public:
+    ProgressEstimator(int total_steps, const progress_estimate& estimate);
+
+    void   update(int step, double cpu_time, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+    double fraction_done() const { return estimate_.fraction_done; }
+    double time_remaining() const;
+    const progress_estimate& estimate() const { return estimate_; }
+
+  private:
+    static constexpr double EWMA_WEIGHT = 0.2;     // weight of the latest step in the step rate
+
+    int               total_steps_;
+    progress_estimate estimate_;
+    int               last_step_ = -1;
+    bool              have_reference_ = false;     // last_step_time_ is the start of a step
+    std::chrono::steady_clock::time_point last_step_time_;
+    double            last_step_cpu_ = 0.0;
+    double            steps_done_ = 0.0;
+};
+
+// How to start a model process with launch_model(). Everything is prepared in the parent.
+struct launch_spec {
+    std::string              exe;            // path of the executable, also argv[0]
+    std::vector<std::string> args;           // arguments after argv[0]
+    std::vector<std::string> env;            // complete environment, "NAME=value"
+    std::vector<std::pair<int, rlim_t>> rlimits;   // soft resource limits for the child only
+    std::vector<int>         cpus;           // cpus the child may run on, all if empty
+    std::string              stdout_file;    // appended to if set, otherwise inherited
+    std::string              stderr_file;
+};
+
+// A model process started by launch_model().
+struct child_process {
+    long pid   = -1;        // -1 if the launch failed
+    int  pidfd = -1;        // pidfd to supervise the process, -1 if not supported
+};
+
+// A task input zip file to copy into the slot and unzip, see copy_and_unzip().
+struct unzip_job {
+    std::string zipfile;        // file in the slot, with the tag naming the 'jf_' file in the project dir
+    std::string destination;    // where to copy the zip file to
+    std::string unzip_path;     // directory to unzip into
+    std::string type;           // name for messages
+};
+
+// Performance of the task so far, sent with each trickle (see process_trickle) for statistics across hosts.
+struct task_perf {
+    double        wall_per_step  = 0;    // secs per model step in this run of the task
+    double        cpu_per_step   = 0;    // model cpu secs per step, all threads
+    double        cpu_efficiency = 0;    // cpu / (wall x threads)
+    double        zip_mb_per_sec = 0;    // compressing model output into upload files, MB of output per sec
+    double        zip_ratio      = 0;    // model output size / upload file size
+    std::uint64_t staged_bytes   = 0;    // input files unzipped for the model
+    std::uint64_t uploaded_bytes = 0;    // upload files created
+    double        suspended_secs = 0;    // time the model has been suspended by the client
+    int           slowdowns      = 0;    // times the model steps slowed down, see ThroughputMonitor
+    std::uint64_t peak_rss       = 0;    // bytes, of the model
+    double        remaining_secs = -1;   // estimated wall secs to the end of the model run, -1 if not yet known
+};
+
+// An upload started with boinc_upload_file() that the client has not yet reported on.
+constexpr int UPLOAD_CHECK_MIN = 7;       // secs before first status check
+constexpr int UPLOAD_CHECK_MAX = 600;     // max secs between status checks
+struct upload_status {
+    std::string                        name;        // logical upload file name
+    std::chrono::steady_clock::time_point next_check;
+    int                                interval;    // secs
+    std::uint64_t                      started_us;  // trace time the upload was started
+};
+
 int initialise_boinc(std::string&, std::string&, std::string&, int&);
 int move_and_unzip_app_file(std::string, std::string, std::string, std::string);
 int check_child_status(long, int);
-int check_boinc_status(long, int);
-long launch_process_oifs(const std::string&, const std::string&, const std::string&, const std::string&, const std::string&, const std::string&);
-long launch_process_wrf(const std::string, const char*);
+class UploadWorker;
+int check_boinc_status(long, int, double* suspended_secs = nullptr, UploadWorker* upload_worker = nullptr);
+bool wait_for_child(long, int, int pidfd = -1);
+child_process launch_model(const launch_spec&);
 std::string get_tag(const std::string &str);
-void process_trickle(double, const std::string, const std::string, const std::string, int, int);
+void process_trickle(double, const std::string, const std::string, const std::string, int, int, const task_perf* perf = nullptr);
+std::string trickle_perf_block(const task_perf&);
 bool file_exists(const std::string &str);
 bool file_is_empty(const std::string &str);
+bool fsync_file(const std::string&);
+int  start_upload(const std::string&, std::vector<upload_status>&);
+void poll_upload_status(std::vector<upload_status>&, bool force = false);
+void wait_upload_status(std::vector<upload_status>&, int);
 double cpu_time(long);
-double model_frac_done(double, double, int);
 std::string get_second_part(const std::string&, const std::string&);
 int move_result_file(std::string, std::string, std::string, std::string);
+MoveMethod move_file(const std::string&, const std::string&);
+const char* move_method_name(MoveMethod);
+int move_result_files(const std::string&, const std::string&, const std::string&);
+std::vector<int> oifs_output_steps(int, int, int);
 bool check_stoi(std::string& cin);
 bool oifs_parse_stat(const std::string&, std::string&, const int);
 bool fread_last_line(const std::string&, std::string&);
 bool oifs_valid_step(std::string&,int);
 int  print_last_lines(std::string filename, int nlines);
-void read_progress_file(std::string, int&, int&, std::string&, int&, int&);
-void update_progress_file(std::string, int, int, std::string, int, int);
+int  read_last_lines(const std::string& filename, int maxlines, std::string& lines);
+bool read_progress_file(std::string, double&, int&, std::string&, int&, int&, progress_estimate* estimate = nullptr);
+void update_progress_file(std::string, double, int, std::string, int, int, const progress_estimate& estimate = progress_estimate());
+void print_progress_file(const std::string&);
 bool read_rcf_file(std::ifstream&, std::string&, std::string&);
 bool read_delimited_line(std::string, const std::string&, const std::string&, int, std::string&);
 bool extract_key_value( const std::string&, const std::string&, char, std::string& );
-int copy_and_unzip(const std::string&, const std::string&, const std::string&, const std::string&);
+int copy_and_unzip(const std::string&, const std::string&, const std::string&, const std::string&, const cpdn_zip_control* control = nullptr);
+int copy_and_unzip_concurrent(const std::vector<unzip_job>&, bool write_behind = false, bool low_disk = false, std::uint64_t* staged_bytes = nullptr);
+cpdn_zip_control boinc_zip_control(const std::string&, std::atomic<bool>&);
 bool set_env_var(const std::string&, const std::string&);
+void set_env_var(std::vector<std::string>&, const std::string&, const std::string&);
+std::string get_env_var(const std::vector<std::string>&, const std::string&);
+std::vector<std::string> current_environment(const std::string& exclude = "");
+int  get_env_int(const std::string&, int);
 bool parse_export(const std::string&, std::string&, std::string&);
-bool process_env_overrides(const std::filesystem::path&);
+bool process_env_overrides(const std::filesystem::path&, const std::string& prefix = "");
+bool process_env_overrides(const std::filesystem::path&, std::vector<std::string>&, const std::string& prefix = "",
+                           const std::string& exclude = "");
 bool set_exec_perms(const std::string&);
 
 using namespace rapidxml;
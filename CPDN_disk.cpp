@@ -0,0 +1,78 @@
+//
+// Disk space used by a task in its slot and temp folder, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#include <iostream>
+#include <algorithm>
+
+#include "CPDN_disk.h"
+
+namespace fs = std::filesystem;
+
+
+DiskFootprint::DiskFootprint(std::uint64_t bound, double high) : bound_(bound), high_(high) {}
+
+
+void DiskFootprint::scan_slot(const fs::path& slot) {
+    std::error_code ec;
+    if (!inputs_scanned_) {
+       slot_inputs_ = 0;
+       for (const auto& entry : fs::directory_iterator(slot, ec)) {
+          if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+             slot_inputs_ += directory_size(entry.path(), true);
+          }
+       }
+       inputs_scanned_ = true;
+    }
+    slot_files_ = directory_size(slot, false);
+}
+
+
+void DiskFootprint::scan_temp(const fs::path& temp) {
+    temp_ = directory_size(temp, true);
+}
+
+
+void DiskFootprint::moved_to_temp(std::uint64_t bytes) {
+    slot_files_ -= std::min(slot_files_, bytes);
+    temp_       += bytes;
+}
+
+
+void DiskFootprint::removed_from_temp(std::uint64_t bytes) {
+    temp_ -= std::min(temp_, bytes);
+}
+
+
+bool DiskFootprint::near_bound() {
+    bool near = bound_ > 0 && usage() >= high_ * bound_;
+    if (near != near_) {
+       std::cerr << "Disk usage of slot & temp folder: " << (usage() >> 20) << " MiB of " << (bound_ >> 20) << " MiB allowed"
+                 << (near ? ", nearly full\n" : "\n");
+       near_ = near;
+    }
+    return near;
+}
+
+
+std::uint64_t directory_size(const fs::path& dir, bool recursive) {
+    std::uint64_t size = 0;
+    std::error_code ec;
+
+    auto add = [&](const fs::directory_entry& entry) {
+       std::error_code fec;
+       if (entry.is_regular_file(fec) && !entry.is_symlink(fec)) {
+          std::uint64_t bytes = entry.file_size(fec);
+          if (!fec) size += bytes;
+       }
+    };
+    if (recursive) {
+       for (const auto& entry : fs::recursive_directory_iterator(dir, fs::directory_options::skip_permission_denied, ec)) add(entry);
+    }
+    else {
+       for (const auto& entry : fs::directory_iterator(dir, ec)) add(entry);
+    }
+    return size;
+}
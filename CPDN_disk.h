@@ -0,0 +1,45 @@
+//
+// Disk space used by a task in its slot and temp folder, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+
+// Tracks the disk space used by the task, in the slot directory and the temp folder in the project
+// directory where the model output waits to be uploaded, against the client's disk bound for the task
+// (rsc_disk_bound). The temp folder is kept up to date from the files the control code moves in and
+// deletes. The model writes to the top of the slot directly, so that is re-measured with scan_slot().
+// Its subdirectories (the staged input data) don't change and are only measured the first time.
+class DiskFootprint {
+  public:
+    // bound in bytes, 0 if unknown; high is the fraction of the bound that counts as nearly full.
+    DiskFootprint(std::uint64_t bound, double high);
+
+    void scan_slot(const std::filesystem::path&);
+    void scan_temp(const std::filesystem::path&);
+    void moved_to_temp(std::uint64_t bytes);      // a file moved from the slot to the temp folder
+    void removed_from_temp(std::uint64_t bytes);  // a file deleted from the temp folder
+
+    std::uint64_t usage() const { return slot_inputs_ + slot_files_ + temp_; }
+    std::uint64_t bound() const { return bound_; }
+
+    // True if the usage is over the high fraction of the bound. Logs when that changes.
+    bool near_bound();
+
+  private:
+    std::uint64_t bound_;
+    double        high_;
+    std::uint64_t slot_inputs_ = 0;     // slot subdirectories
+    std::uint64_t slot_files_  = 0;     // files at the top of the slot
+    std::uint64_t temp_        = 0;
+    bool          inputs_scanned_ = false;
+    bool          near_ = false;
+};
+
+// Total size of the files in a directory, recursively if asked.
+std::uint64_t directory_size(const std::filesystem::path&, bool recursive);
@@ -0,0 +1,201 @@
+//
+// Model memory requirements and host memory available, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#include <map>
+#include <limits>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <algorithm>
+#include <filesystem>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "CPDN_memory.h"
+#include "CPDN_control_code.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr std::uint64_t MiB = 1024 * 1024;
+    constexpr std::uint64_t GiB = 1024 * MiB;
+    constexpr std::uint64_t UNKNOWN = std::numeric_limits<std::uint64_t>::max();
+
+    // Memory for each model thread besides its stack: per-thread work arrays and buffers.
+    constexpr std::uint64_t THREAD_MEMORY = 64 * MiB;
+
+    // Spectral truncation from a resolution string such as "159" or "TL255"; 0 if there isn't one.
+    int truncation(const std::string& horiz_resolution) {
+        size_t digits = horiz_resolution.find_first_of("0123456789");
+        return digits == std::string::npos ? 0 : std::atoi(horiz_resolution.c_str() + digits);
+    }
+
+    // First value in a file, e.g. memory.max, or UNKNOWN if missing or "max".
+    std::uint64_t read_limit(const fs::path& path) {
+        std::ifstream in(path);
+        std::string value;
+        if (!(in >> value) || value == "max") return UNKNOWN;
+        try {
+           return std::stoull(value);
+        }
+        catch (...) {
+           return UNKNOWN;
+        }
+    }
+
+    // Smallest free space (limit - usage) of a cgroup and its parents.
+    std::uint64_t cgroup_free(const fs::path& root, fs::path group, const char* limit_file, const char* usage_file) {
+        std::uint64_t free = UNKNOWN;
+        while (true) {
+           fs::path dir = root / group.relative_path();
+           std::uint64_t limit = read_limit(dir / limit_file);
+           // cgroup v1 reports 'no limit' as a huge number
+           if (limit != UNKNOWN && limit < (std::uint64_t(1) << 60)) {
+              std::uint64_t usage = read_limit(dir / usage_file);
+              if (usage == UNKNOWN) usage = 0;
+              free = std::min(free, limit > usage ? limit - usage : 0);
+           }
+           if (group.relative_path().empty()) break;
+           group = group.parent_path();
+        }
+        return free;
+    }
+}
+
+
+int omp_stacksize_mb(const std::string& horiz_resolution) {
+    int res = truncation(horiz_resolution);
+    if (res >= 639) return 512;
+    if (res >= 511) return 256;
+    return 128;
+}
+
+
+std::uint64_t model_footprint(const std::string& horiz_resolution, int nthreads) {
+    // Resident memory of the model itself (fields, spectral transforms, I/O buffers) by resolution,
+    // from OpenIFS runs. Unknown resolutions are taken as T319.
+    static const std::vector<std::pair<int, std::uint64_t>> model_memory = {
+       {   0, GiB / 2 },       // T21 - T95
+       { 159, 3 * GiB / 2 },
+       { 255, 3 * GiB },
+       { 319, 9 * GiB / 2 },
+       { 511, 10 * GiB },
+       { 639, 16 * GiB },
+    };
+    int res = truncation(horiz_resolution);
+    if (res == 0) res = 319;
+
+    std::uint64_t memory = 0;
+    for (const auto& entry : model_memory) {
+       if (res >= entry.first) memory = entry.second;
+    }
+    return memory + std::max(nthreads, 1) * (omp_stacksize_mb(horiz_resolution) * MiB + THREAD_MEMORY);
+}
+
+
+std::uint64_t available_memory(const std::string& proc, const std::string& cgroup) {
+    std::uint64_t available = UNKNOWN;
+
+    std::ifstream meminfo(proc + "/meminfo");
+    std::string key;
+    std::uint64_t kb;
+    while (meminfo >> key >> kb) {
+       if (key == "MemAvailable:") {
+          available = kb * 1024;
+          break;
+       }
+       meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+
+    // Lines are 'hierarchy-ID:controllers:path', v2 has the single line '0::path'.
+    std::ifstream cgroups(proc + "/self/cgroup");
+    std::string line;
+    while (std::getline(cgroups, line)) {
+       size_t first  = line.find(':');
+       size_t second = line.find(':', first + 1);
+       if (first == std::string::npos || second == std::string::npos) continue;
+       std::string controllers = line.substr(first + 1, second - first - 1);
+       fs::path    group       = line.substr(second + 1);
+
+       if (line.compare(0, first, "0") == 0 && controllers.empty()) {
+          available = std::min(available, cgroup_free(cgroup, group, "memory.max", "memory.current"));
+       }
+       else if (("," + controllers + ",").find(",memory,") != std::string::npos) {
+          available = std::min(available, cgroup_free(fs::path(cgroup) / "memory", group, "memory.limit_in_bytes", "memory.usage_in_bytes"));
+       }
+    }
+    return available;
+}
+
+
+std::uint64_t other_tasks_memory(const std::string& project_path) {
+    std::uint64_t pending = 0;
+#if defined(__linux__)
+    std::error_code ec;
+    fs::path project = fs::weakly_canonical(project_path, ec);
+    if (ec || project.empty()) return 0;
+    const std::string project_dir = project.string() + "/";
+    const std::uint64_t page_size = sysconf(_SC_PAGESIZE);
+
+    // Parent and resident size of every process, and the other control code processes of this project.
+    std::map<pid_t, std::uint64_t> child_rss;       // resident memory of the children of each process
+    std::vector<pid_t> tasks;
+    for (const auto& entry : fs::directory_iterator("/proc", ec)) {
+       std::string name = entry.path().filename().string();
+       if (name.find_first_not_of("0123456789") != std::string::npos) continue;
+       pid_t pid = (pid_t) std::stol(name);
+
+       std::ifstream stat(entry.path() / "stat");
+       std::string content;
+       std::getline(stat, content);
+       size_t paren = content.rfind(')');
+       if (paren == std::string::npos) continue;
+
+       // Fields after the command name start at 3 (state); ppid is field 4 and rss (pages) field 24.
+       std::istringstream fields(content.substr(paren + 2));
+       std::string field;
+       pid_t ppid = 0;
+       std::uint64_t rss = 0;
+       for (int i = 3; i <= 24 && fields >> field; i++) {
+          if (i == 4)  ppid = (pid_t) std::atol(field.c_str());
+          if (i == 24) rss  = std::strtoull(field.c_str(), nullptr, 10) * page_size;
+       }
+       child_rss[ppid] += rss;
+
+       if (pid == getpid()) continue;
+       fs::path exe = fs::read_symlink(entry.path() / "exe", ec);
+       if (!ec && exe.string().rfind(project_dir, 0) == 0) {
+          tasks.push_back(pid);
+       }
+    }
+
+    for (auto pid : tasks) {
+       // The task's slot is its working directory, its model is the child process.
+       fs::path slot = fs::read_symlink("/proc/" + std::to_string(pid) + "/cwd", ec);
+       if (ec) continue;
+
+       std::string horiz_resolution, line;
+       std::ifstream namelist(slot / "fort.4");
+       while (std::getline(namelist, line)) {
+          if (extract_key_value(line, "HORIZ_RESOLUTION", '=', horiz_resolution)) break;
+       }
+
+       std::uint64_t footprint = model_footprint(horiz_resolution, 2);
+       std::uint64_t rss = child_rss.count(pid) ? child_rss[pid] : 0;
+       if (footprint > rss) pending += footprint - rss;
+    }
+#endif
+    return pending;
+}
+
+
+int threads_that_fit(const std::string& horiz_resolution, int nthreads, int min_nthreads, std::uint64_t available) {
+    for (int n = nthreads; n >= min_nthreads && n >= 1; n--) {
+       if (model_footprint(horiz_resolution, n) <= available) return n;
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+//
+// Model memory requirements and host memory available, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+
+// OpenMP stack size per thread in MiB for the horizontal resolution (e.g. "255", "TL319").
+// Never less than the 128M the model has always been run with.
+int omp_stacksize_mb(const std::string& horiz_resolution);
+
+// Estimated resident memory of the model, in bytes, at this resolution on nthreads threads.
+std::uint64_t model_footprint(const std::string& horiz_resolution, int nthreads);
+
+// Memory available to this task: MemAvailable from meminfo, limited by the memory.max (cgroup v2)
+// or memory.limit_in_bytes (v1) of our cgroup and its parents. Returns UINT64_MAX if unknown.
+// The proc & cgroup roots can be changed for testing.
+std::uint64_t available_memory(const std::string& proc = "/proc", const std::string& cgroup = "/sys/fs/cgroup");
+
+// Memory other CPDN tasks from this project are still expected to take: for each other running
+// control code (executable in the project directory), the footprint of its model, read from its slot's
+// fort.4, less what the model process is using now. A task still staging files will take all of it.
+std::uint64_t other_tasks_memory(const std::string& project_path);
+
+// Number of threads, from nthreads down to min_nthreads, whose footprint fits in 'available' bytes.
+// Returns 0 if even min_nthreads doesn't fit.
+int threads_that_fit(const std::string& horiz_resolution, int nthreads, int min_nthreads, std::uint64_t available);
@@ -0,0 +1,389 @@
+//
+// Process statistics for the model process, read from /proc, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <iomanip>
+#include <string_view>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "CPDN_proc_stats.h"
+#include "CPDN_control_code.h"
+
+namespace {
+    constexpr int CHILD_RESCAN = 60;    // look for new model child processes every this many samples
+
+    constexpr double MB = 1024.0 * 1024.0;
+
+    // Names of the metrics in the summary: rss & pss, then rates per sec of the totals.
+    const char* const METRICS[8] = { "rss_mb", "pss_mb", "read_mb_per_s", "write_mb_per_s", "minor_faults_per_s",
+                                     "major_faults_per_s", "voluntary_switches_per_s", "involuntary_switches_per_s" };
+
+    // Child processes of a process, from the children file of each of its threads.
+    std::vector<pid_t> child_processes(pid_t pid) {
+       std::vector<pid_t> children;
+       std::error_code ec;
+       for (const auto& task : std::filesystem::directory_iterator("/proc/" + std::to_string(pid) + "/task", ec)) {
+          std::ifstream children_file(task.path() / "children");
+          pid_t child;
+          while (children_file >> child) children.push_back(child);
+       }
+       return children;
+    }
+}
+
+
+ProcFile& ProcFile::operator=(ProcFile&& other) noexcept {
+    if (this != &other) {
+       close();
+       fd_ = other.fd_;
+       other.fd_ = -1;
+    }
+    return *this;
+}
+
+
+bool ProcFile::open(const std::string& path) {
+    close();
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    return fd_ >= 0;
+}
+
+
+void ProcFile::close() {
+    if (fd_ >= 0) {
+       ::close(fd_);
+       fd_ = -1;
+    }
+}
+
+
+bool ProcFile::read(std::string& buf) const {
+    if (fd_ < 0) return false;
+
+    // /proc files report a size of zero, so grow the buffer until the whole file fits.
+    if (buf.size() < 1024) buf.resize(1024);
+    for (;;) {
+       ssize_t nbytes = pread(fd_, buf.data(), buf.size(), 0);
+       if (nbytes < 0) {
+          return false;
+       }
+       if ((size_t) nbytes < buf.size()) {
+          buf[nbytes] = '\0';
+          return nbytes > 0;
+       }
+       buf.resize(buf.size() * 2);
+    }
+}
+
+
+bool parse_proc_stat_cpu(const std::string& stat, unsigned long long& ticks) {
+    // The process name (field 2) is in brackets and may contain spaces, so start after the last ')'.
+    // Fields after it start at 3 (state); utime, stime, cutime, cstime are fields 14 to 17.
+    const char* p = strrchr(stat.c_str(), ')');
+    if (p == NULL) return false;
+    p++;
+
+    ticks = 0;
+    for (int field = 3; field <= 17; field++) {
+       while (*p == ' ') p++;
+       if (*p == '\0') return false;
+       if (field >= 14) {
+          char* end;
+          ticks += strtoull(p, &end, 10);
+          p = end;
+       }
+       else {
+          while (*p != ' ' && *p != '\0') p++;
+       }
+    }
+    return true;
+}
+
+
+std::uint64_t peak_rss(pid_t pid) {
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string key;
+    std::uint64_t kb;
+    while (status >> key) {
+       if (key == "VmHWM:") {
+          return (status >> kb) ? kb * 1024 : 0;
+       }
+       status.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return 0;
+}
+
+
+ModelCpuTime::ModelCpuTime(pid_t pid, double previous_cpu_time)
+    : pid_(pid), previous_(previous_cpu_time)
+{
+    clock_tick_ = (double) sysconf(_SC_CLK_TCK);
+#if defined(__linux__)
+    if (!stat_.open("/proc/" + std::to_string(pid) + "/stat")) {
+       std::cerr << "..ModelCpuTime: unable to open /proc stat file for process: " << pid << '\n';
+    }
+#endif
+}
+
+
+double ModelCpuTime::read_stat(const ProcFile& stat, bool& ok) {
+    unsigned long long ticks = 0;
+
+    ok = stat.read(buf_) && parse_proc_stat_cpu(buf_, ticks);
+    return ok ? (double) ticks / clock_tick_ : 0.0;
+}
+
+
+// Any child processes of the model: look in the children file of every model thread.
+void ModelCpuTime::find_children() {
+    std::error_code ec;
+    std::vector<std::pair<pid_t, ProcFile>> children;
+
+    for (const auto& task : std::filesystem::directory_iterator("/proc/" + std::to_string(pid_) + "/task", ec)) {
+       std::ifstream children_file(task.path() / "children");
+       pid_t child;
+       while (children_file >> child) {
+          auto known = std::find_if(children_.begin(), children_.end(), [child](const auto& c) { return c.first == child; });
+          if (known != children_.end()) {
+             children.push_back(std::move(*known));
+          }
+          else {
+             children.emplace_back(child, ProcFile("/proc/" + std::to_string(child) + "/stat"));
+          }
+       }
+    }
+    children_ = std::move(children);
+}
+
+
+double ModelCpuTime::sample() {
+#if defined(__linux__)
+    bool ok;
+    double cpu = read_stat(stat_, ok);
+    if (!ok) {
+       return total();          // model has exited, keep the last value
+    }
+
+    if (nsamples_++ % CHILD_RESCAN == 0) {
+       find_children();
+    }
+    // Once reaped, a child's cpu time is in the model's cutime & cstime, so stop reading it.
+    for (auto it = children_.begin(); it != children_.end(); ) {
+       double child_cpu = read_stat(it->second, ok);
+       if (!ok) {
+          it = children_.erase(it);
+          continue;
+       }
+       cpu += child_cpu;
+       ++it;
+    }
+    current_ = std::max(current_, cpu);
+#else
+    double cpu = cpu_time(pid_);
+    if (cpu > 0) current_ = std::max(current_, cpu);
+#endif
+    return total();
+}
+
+
+bool parse_proc_field(const std::string& content, const char* key, std::uint64_t& value) {
+    // The content may be a read buffer, only use it up to the terminating null.
+    std::string_view text(content.c_str());
+    std::size_t length = strlen(key);
+
+    for (std::size_t pos = text.find(key); pos != std::string_view::npos; pos = text.find(key, pos + 1)) {
+       if ((pos == 0 || text[pos - 1] == '\n') && text.compare(pos + length, 1, ":") == 0) {
+          value = strtoull(content.c_str() + pos + length + 1, nullptr, 10);
+          return true;
+       }
+    }
+    return false;
+}
+
+
+bool parse_proc_stat_faults(const std::string& stat, std::uint64_t& minor, std::uint64_t& major) {
+    // As parse_proc_stat_cpu: minflt is field 10 and majflt field 12.
+    const char* p = strrchr(stat.c_str(), ')');
+    if (p == NULL) return false;
+    p++;
+
+    for (int field = 3; field <= 12; field++) {
+       while (*p == ' ') p++;
+       if (*p == '\0') return false;
+       char* end;
+       std::uint64_t value = strtoull(p, &end, 10);
+       if (field == 10) minor = value;
+       if (field == 12) major = value;
+       p = end;
+       while (*p != ' ' && *p != '\0') p++;
+    }
+    return true;
+}
+
+
+void ResourceSampler::running_stats::add(double value) {
+    min = (n == 0) ? value : std::min(min, value);
+    max = (n == 0) ? value : std::max(max, value);
+    sum += value;
+    n++;
+}
+
+
+ResourceSampler::ResourceSampler(pid_t pid, int interval, std::size_t max_points)
+    : pid_(pid), interval_(interval), max_points_(std::max<std::size_t>(max_points, 2)),
+      start_(std::chrono::steady_clock::now()), next_(start_) {}
+
+
+// Open the files of any new processes and threads in the model's process tree and forget those that have gone.
+void ResourceSampler::find_processes() {
+    std::map<pid_t, process_files> found;
+    std::vector<pid_t> pids = { pid_ };
+    for (std::size_t i = 0; i < pids.size(); i++) {
+       pid_t pid = pids[i];
+       for (auto child : child_processes(pid)) pids.push_back(child);
+
+       std::string dir = "/proc/" + std::to_string(pid);
+       auto known = processes_.find(pid);
+       process_files& files = found[pid];
+       if (known != processes_.end()) {
+          files = std::move(known->second);
+       }
+       else {
+          files.stat.open(dir + "/stat");
+          if (!files.smaps.open(dir + "/smaps_rollup")) files.status.open(dir + "/status");
+          files.io.open(dir + "/io");
+       }
+
+       std::map<pid_t, ProcFile> threads;
+       std::error_code ec;
+       for (const auto& task : std::filesystem::directory_iterator(dir + "/task", ec)) {
+          pid_t tid = (pid_t) std::atol(task.path().filename().c_str());
+          auto thread = files.threads.find(tid);
+          threads[tid] = (thread != files.threads.end()) ? std::move(thread->second) : ProcFile((task.path() / "status").string());
+       }
+       files.threads = std::move(threads);
+    }
+    processes_ = std::move(found);
+}
+
+
+bool ResourceSampler::take_sample(resource_sample& sample) {
+    find_processes();
+
+    sample = last_;
+    sample.secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    sample.rss = sample.pss = 0;
+    std::uint64_t* totals[6] = { &sample.read_bytes, &sample.write_bytes, &sample.minor_faults, &sample.major_faults,
+                                 &sample.voluntary_switches, &sample.involuntary_switches };
+    bool model_running = false;
+
+    for (auto& entry : processes_) {
+       process_files& files = entry.second;
+       std::uint64_t now[6] = {}, value = 0;
+
+       if (!files.stat.read(buf_) || !parse_proc_stat_faults(buf_, now[2], now[3])) continue;   // gone
+       if (entry.first == pid_) model_running = true;
+
+       // Linux before 4.14 has no smaps_rollup, then PSS isn't known and is taken as the RSS.
+       if (files.smaps.read(buf_)) {
+          if (parse_proc_field(buf_, "Rss", value)) sample.rss += value * 1024;
+          if (parse_proc_field(buf_, "Pss", value)) sample.pss += value * 1024;
+       }
+       else if (files.status.read(buf_) && parse_proc_field(buf_, "VmRSS", value)) {
+          sample.rss += value * 1024;
+          sample.pss += value * 1024;
+       }
+       if (files.io.read(buf_)) {
+          parse_proc_field(buf_, "read_bytes", now[0]);
+          parse_proc_field(buf_, "write_bytes", now[1]);
+       }
+       for (const auto& thread : files.threads) {
+          if (!thread.second.read(buf_)) continue;
+          if (parse_proc_field(buf_, "voluntary_ctxt_switches", value))    now[4] += value;
+          if (parse_proc_field(buf_, "nonvoluntary_ctxt_switches", value)) now[5] += value;
+       }
+
+       // The counts of a thread that has exited are lost, so only add increases.
+       for (int i = 0; i < 6; i++) {
+          if (now[i] > files.last[i]) *totals[i] += now[i] - files.last[i];
+          files.last[i] = now[i];
+       }
+    }
+    return model_running;
+}
+
+
+bool ResourceSampler::sample() {
+#if defined(__linux__)
+    auto now = std::chrono::steady_clock::now();
+    if (interval_.count() <= 0 || now < next_) return false;
+    next_ = now + interval_;
+
+    resource_sample sample;
+    if (!take_sample(sample)) return false;
+
+    stats_[0].add(sample.rss / MB);
+    stats_[1].add(sample.pss / MB);
+    double secs = sample.secs - last_.secs;
+    if (nsamples_ > 0 && secs > 0) {
+       stats_[2].add((sample.read_bytes - last_.read_bytes) / MB / secs);
+       stats_[3].add((sample.write_bytes - last_.write_bytes) / MB / secs);
+       stats_[4].add((sample.minor_faults - last_.minor_faults) / secs);
+       stats_[5].add((sample.major_faults - last_.major_faults) / secs);
+       stats_[6].add((sample.voluntary_switches - last_.voluntary_switches) / secs);
+       stats_[7].add((sample.involuntary_switches - last_.involuntary_switches) / secs);
+    }
+    last_ = sample;
+
+    // Keep every stride'th sample. When the series is full drop every other one and double the stride.
+    if (nsamples_++ % stride_ == 0) {
+       series_.push_back(sample);
+       if (series_.size() > max_points_) {
+          std::size_t kept = 0;
+          for (std::size_t i = 0; i < series_.size(); i += 2) series_[kept++] = series_[i];
+          series_.resize(kept);
+          stride_ *= 2;
+       }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+void ResourceSampler::summary(std::ostream& out) const {
+    std::ostringstream lines;
+    lines << std::fixed << std::setprecision(2);
+    lines << "RESOURCES samples=" << nsamples_ << " interval_s=" << interval_.count() << " secs=" << last_.secs
+          << " read_mb=" << last_.read_bytes / MB << " write_mb=" << last_.write_bytes / MB
+          << " minor_faults=" << last_.minor_faults << " major_faults=" << last_.major_faults
+          << " voluntary_switches=" << last_.voluntary_switches << " involuntary_switches=" << last_.involuntary_switches << '\n';
+    for (int i = 0; i < 8; i++) {
+       const running_stats& s = stats_[i];
+       lines << "RESOURCES metric=" << METRICS[i] << " min=" << s.min << " max=" << s.max
+             << " mean=" << (s.n > 0 ? s.sum / s.n : 0.0) << '\n';
+    }
+    out << lines.str();
+}
+
+
+bool ResourceSampler::write(const std::string& path) const {
+    std::ofstream out(path);
+    summary(out);
+    out << "\nsecs,rss_mb,pss_mb,read_mb,write_mb,minor_faults,major_faults,voluntary_switches,involuntary_switches\n"
+        << std::fixed << std::setprecision(1);
+    for (const auto& s : series_) {
+       out << s.secs << ',' << s.rss / MB << ',' << s.pss / MB << ',' << s.read_bytes / MB << ',' << s.write_bytes / MB << ','
+           << s.minor_faults << ',' << s.major_faults << ',' << s.voluntary_switches << ',' << s.involuntary_switches << '\n';
+    }
+    out.close();
+    return !out.fail();
+}
@@ -0,0 +1,138 @@
+//
+// Process statistics for the model process, read from /proc, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#pragma once
+
+#include <map>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <utility>
+#include <cstdint>
+#include <sys/types.h>
+
+
+// Read access to a /proc file that's opened once and re-read from the start with pread.
+// Much cheaper than opening and parsing the file each time it's needed.
+class ProcFile {
+  public:
+    ProcFile() = default;
+    explicit ProcFile(const std::string& path) { open(path); }
+    ~ProcFile() { close(); }
+
+    ProcFile(const ProcFile&) = delete;
+    ProcFile& operator=(const ProcFile&) = delete;
+    ProcFile(ProcFile&& other) noexcept : fd_(other.fd_) { other.fd_ = -1; }
+    ProcFile& operator=(ProcFile&& other) noexcept;
+
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const { return fd_ >= 0; }
+
+    // Re-read the file into buf (null terminated). Returns false if it can't be read, e.g. the process has gone.
+    bool read(std::string& buf) const;
+
+  private:
+    int fd_ = -1;
+};
+
+
+// CPU time used by the model: all its (OpenMP) threads plus any child processes, live or reaped.
+// Keeps /proc/<pid>/stat open and is sampled once per main loop. The total includes the cpu time
+// from previous runs of the task so it can be saved to the progress file, and never decreases.
+class ModelCpuTime {
+  public:
+    ModelCpuTime(pid_t pid, double previous_cpu_time);
+
+    // Take a new sample; returns the total cpu time in seconds.
+    double sample();
+    double total() const { return previous_ + current_; }
+
+  private:
+    double read_stat(const ProcFile& stat, bool& ok);
+    void   find_children();
+
+    pid_t    pid_;
+    ProcFile stat_;
+    std::vector<std::pair<pid_t, ProcFile>> children_;    // live child processes of the model
+    double   previous_;           // secs, from previous runs
+    double   current_  = 0.0;     // secs, this run
+    double   clock_tick_;     // clock ticks per sec
+    int      nsamples_ = 0;
+    std::string buf_;
+};
+
+// Peak resident memory (VmHWM) of a process in bytes, 0 if it can't be read.
+std::uint64_t peak_rss(pid_t pid);
+
+// Parse utime+stime+cutime+cstime (in clock ticks) from the content of a /proc/<pid>/stat file.
+bool parse_proc_stat_cpu(const std::string& stat, unsigned long long& ticks);
+
+// Parse the value of 'key:' in a /proc status, io or smaps_rollup file. Returns false if the key is missing.
+bool parse_proc_field(const std::string& content, const char* key, std::uint64_t& value);
+
+// Parse the minor and major page faults (minflt, majflt) from the content of a /proc/<pid>/stat file.
+bool parse_proc_stat_faults(const std::string& stat, std::uint64_t& minor, std::uint64_t& major);
+
+
+// Resources used by the model and its child processes at one time. The I/O, faults and context
+// switches are totals since the processes started.
+struct resource_sample {
+    double        secs = 0;                  // since the sampler was created
+    std::uint64_t rss = 0, pss = 0;          // bytes
+    std::uint64_t read_bytes = 0, write_bytes = 0;
+    std::uint64_t minor_faults = 0, major_faults = 0;
+    std::uint64_t voluntary_switches = 0, involuntary_switches = 0;
+};
+
+// Samples the memory, I/O, page faults and context switches of the model process tree every 'interval'
+// secs. Keeps the min, max and mean of each and a series of at most max_points samples, which is thinned
+// out as it fills so it covers the whole run. The /proc files are kept open and re-read with pread.
+class ResourceSampler {
+  public:
+    ResourceSampler(pid_t pid, int interval, std::size_t max_points = 256);
+
+    // Take a sample if one is due. Returns false if not, or the model has exited.
+    bool sample();
+
+    const std::vector<resource_sample>& series() const { return series_; }
+    int samples() const { return nsamples_; }
+
+    // 'RESOURCES' lines with key=value fields: the number of samples, then min, max and mean per metric.
+    void summary(std::ostream&) const;
+
+    // The summary followed by the series as CSV.
+    bool write(const std::string& path) const;
+
+  private:
+    // The open /proc files of a process and its counters at the last sample.
+    struct process_files {
+        ProcFile stat, smaps, status, io;
+        std::map<pid_t, ProcFile> threads;     // task/<tid>/status, for the context switches of every thread
+        std::uint64_t last[6] = {};            // read, write, minor, major, voluntary, involuntary
+    };
+    struct running_stats {
+        double min = 0, max = 0, sum = 0;
+        int    n = 0;
+        void   add(double value);
+    };
+
+    bool take_sample(resource_sample&);
+    void find_processes();
+
+    pid_t       pid_;
+    std::chrono::seconds interval_;
+    std::size_t max_points_;
+    std::chrono::steady_clock::time_point start_, next_;
+
+    std::map<pid_t, process_files> processes_;
+    resource_sample              last_;             // totals at the last sample
+    std::vector<resource_sample> series_;
+    int         stride_ = 1, nsamples_ = 0;
+    running_stats stats_[8];                        // rss, pss & rates per sec of the totals
+    std::string buf_;
+};
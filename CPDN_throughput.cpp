@@ -0,0 +1,145 @@
+//
+// Model throughput from the step timings in ifs.stat, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+
+#include "CPDN_throughput.h"
+#include "CPDN_trace.h"
+
+namespace {
+    double median(std::vector<float> values) {
+        if (values.empty()) return 0;
+        auto middle = values.begin() + values.size() / 2;
+        std::nth_element(values.begin(), middle, values.end());
+        return *middle;
+    }
+
+    // Value at fraction p of the sorted values.
+    double percentile(std::vector<float> values, double p) {
+        if (values.empty()) return 0;
+        auto at = values.begin() + (std::size_t) (p * (values.size() - 1));
+        std::nth_element(values.begin(), at, values.end());
+        return *at;
+    }
+
+    bool to_double(const std::string& s, double& value) {
+        char* end = nullptr;
+        value = std::strtod(s.c_str(), &end);
+        return end != s.c_str() && *end == '\0';
+    }
+}
+
+
+bool parse_stat_timings(const std::string& line, stat_step& timings) {
+    std::istringstream tokens(line);
+    std::string time, conf, label, step, cpu, vector_cpu, wall;
+    if (!(tokens >> time >> conf >> label >> step >> cpu >> vector_cpu >> wall)) return false;
+
+    char* end = nullptr;
+    long n = std::strtol(step.c_str(), &end, 10);
+    if (*end != '\0' || n < 0) return false;
+
+    timings.step = (int) n;
+    return to_double(cpu, timings.cpu) && to_double(wall, timings.wall);
+}
+
+
+ThroughputMonitor::ThroughputMonitor(std::size_t window, std::size_t baseline_steps, double slowdown, double recovered)
+    : window_size_(std::max<std::size_t>(window, 1)), baseline_steps_(std::max<std::size_t>(baseline_steps, 1)),
+      slowdown_(slowdown), recovered_(recovered) {}
+
+
+int ThroughputMonitor::poll(const std::string& ifs_stat) {
+    std::ifstream in(ifs_stat);
+    if (!in) return 0;
+
+    // A shorter file is a new one, from a model restart.
+    in.seekg(0, std::ios::end);
+    std::streamoff size = in.tellg();
+    if (size < offset_) offset_ = 0;
+    in.seekg(offset_);
+
+    // Only whole lines; the model may be part way through writing the last one.
+    int before = steps();
+    std::string line;
+    while (std::getline(in, line) && !in.eof()) {
+       offset_ = in.tellg();
+       stat_step timings;
+       if (parse_stat_timings(line, timings)) add(timings);
+    }
+    return steps() - before;
+}
+
+
+void ThroughputMonitor::add(const stat_step& timings) {
+    // Lines are repeated at some steps. After a model restart the steps from the restart are run again.
+    if (timings.step == last_step_) return;
+    last_step_ = timings.step;
+
+    // Step 0 includes the model setup.
+    if (timings.step == 0) return;
+
+    walls_.push_back((float) timings.wall);
+    cpus_.push_back((float) timings.cpu);
+    total_wall_ += timings.wall;
+    total_cpu_  += timings.cpu;
+    trace_counter("step wall ms", (std::int64_t) (timings.wall * 1000));
+
+    if (baseline_ == 0) {
+       if (walls_.size() >= baseline_steps_) {
+          baseline_     = median(walls_);
+          baseline_cpu_ = median(cpus_);
+          std::cerr << "Throughput: baseline " << baseline_ << " secs per step, cpu " << baseline_cpu_ << " secs\n";
+       }
+       return;
+    }
+    if (walls_.size() < baseline_steps_ + window_size_ || baseline_ <= 0) return;
+
+    std::vector<float> window(walls_.end() - window_size_, walls_.end());
+    double rate = median(window);
+    if (slow_) slow_steps_++;
+
+    if (!slow_ && rate >= slowdown_ * baseline_) {
+       slow_ = true;
+       slowdowns_++;
+       slow_start_ = timings.step;
+       double cpu = median(std::vector<float>(cpus_.end() - window_size_, cpus_.end()));
+
+       // If the cpu time per step has gone up as much as the wall time the cores are running slower,
+       // otherwise the model is waiting: for cores used by other processes, or for memory being swapped.
+       const char* cause = (baseline_cpu_ > 0 && cpu / baseline_cpu_ >= 0.8 * rate / baseline_)
+                           ? "cpu time per step also up, cores running slower (throttling?)"
+                           : "cpu time per step not up as much, model waiting (other processes or swapping?)";
+       std::ostringstream message;
+       message << std::setprecision(3) << "Throughput: slowdown at step " << timings.step << ", " << rate
+               << " secs per step is " << rate / baseline_ << " x the baseline; " << cause << '\n';
+       std::cerr << message.str();
+       trace_instant("slowdown", "throughput");
+    }
+    else if (slow_ && rate < recovered_ * baseline_) {
+       slow_ = false;
+       std::ostringstream message;
+       message << std::setprecision(3) << "Throughput: recovered at step " << timings.step << " after "
+               << timings.step - slow_start_ << " steps, " << rate << " secs per step\n";
+       std::cerr << message.str();
+       trace_instant("recovered", "throughput");
+    }
+}
+
+
+void ThroughputMonitor::summary(std::ostream& out) const {
+    std::ostringstream line;
+    line << std::setprecision(4) << "THROUGHPUT steps=" << walls_.size() << " wall_s=" << total_wall_ << " cpu_s=" << total_cpu_
+         << " baseline_s=" << baseline_ << " median_s=" << median(walls_) << " p95_s=" << percentile(walls_, 0.95)
+         << " max_s=" << (walls_.empty() ? 0 : *std::max_element(walls_.begin(), walls_.end()))
+         << " slowdowns=" << slowdowns_ << " slow_steps=" << slow_steps_ << '\n';
+    out << line.str();
+}
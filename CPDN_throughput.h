@@ -0,0 +1,66 @@
+//
+// Model throughput from the step timings in ifs.stat, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <ios>
+
+
+// Timings of one model step from an ifs.stat line, e.g.
+//    11:34:34 0AAA00AAA STEPO       1     0.356    0.356    0.361   0:02   0:02 0.18085634484813E-15 0GB   0MB
+// The columns after the step are the cpu time, vector cpu time and wall time of the step, in secs.
+struct stat_step {
+    int    step = 0;
+    double cpu  = 0;
+    double wall = 0;
+};
+
+// Returns false if the line has no step timings, e.g. the setup lines with step -999.
+bool parse_stat_timings(const std::string& line, stat_step& timings);
+
+
+// Follows the timings of the model steps and detects when they slow down compared to the run's
+// baseline, e.g. from thermal throttling, other processes competing for the cores or swapping.
+// The baseline is the median step wall time over the first steps of the run (after step 0 which
+// includes the setup); the current rate is the median over a sliding window of recent steps, so the
+// regular slower steps (radiation, output) don't count as slowdowns.
+class ThroughputMonitor {
+  public:
+    // A slowdown starts when the window median is 'slowdown' x the baseline and ends below 'recovered' x.
+    explicit ThroughputMonitor(std::size_t window = 20, std::size_t baseline_steps = 20,
+                               double slowdown = 1.5, double recovered = 1.2);
+
+    // Read the steps added to ifs.stat since the last call. Returns the number of new steps.
+    int poll(const std::string& ifs_stat);
+
+    // Add the timings of a step. Repeated lines are ignored; going back (a model restart) keeps the baseline.
+    void add(const stat_step&);
+
+    bool   slow()      const { return slow_; }
+    int    slowdowns() const { return slowdowns_; }
+    int    steps()     const { return (int) walls_.size(); }
+    double baseline()  const { return baseline_; }      // secs per step, 0 until there are enough steps
+
+    // Aggregates of the run, one 'THROUGHPUT' line with key=value fields.
+    void summary(std::ostream&) const;
+
+  private:
+    std::size_t window_size_, baseline_steps_;
+    double      slowdown_, recovered_;
+
+    std::vector<float> walls_;        // wall secs of every step this run
+    std::vector<float> cpus_;         // and cpu secs
+    double      total_cpu_ = 0, total_wall_ = 0;
+    int         last_step_ = -1;
+    double      baseline_ = 0, baseline_cpu_ = 0;
+    bool        slow_ = false;
+    int         slowdowns_ = 0, slow_steps_ = 0, slow_start_ = 0;
+
+    std::streamoff offset_ = 0;       // of the next line to read from ifs.stat
+};
@@ -0,0 +1,270 @@
+//
+// Host CPU topology and thread placement for the model, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <cstdlib>
+#include <utility>
+#include <sys/types.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include "CPDN_topology.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    // Read a single integer from a sysfs file, or return the default.
+    int read_sysfs_int(const fs::path& path, int default_value) {
+        std::ifstream in(path);
+        int value;
+        return (in >> value) ? value : default_value;
+    }
+
+    std::string read_sysfs_line(const fs::path& path) {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+
+    // The cpus this process may run on.
+    std::vector<int> process_cpuset() {
+        std::vector<int> cpus;
+#if defined(__linux__)
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+           for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+              if (CPU_ISSET(cpu, &mask)) cpus.push_back(cpu);
+           }
+        }
+#endif
+        return cpus;
+    }
+}
+
+
+int host_topology::physical_cores(const std::set<int>& busy) const {
+    std::set<int> cores, busy_cores;
+    for (const auto& c : cpus) {
+       cores.insert(c.core);
+       if (busy.count(c.cpu)) busy_cores.insert(c.core);
+    }
+    return (int) (cores.size() - busy_cores.size());
+}
+
+
+int max_useful_threads(const std::string& horiz_resolution) {
+    // Serial (non-threaded) fraction of the model timestep by resolution, from OpenIFS scaling runs.
+    // Higher resolutions have more work per thread and scale further.
+    // GC. At T319 the parallel efficiency markedly drops after 8 threads.
+    static const std::vector<std::pair<int, double>> serial_fraction = {
+       {   0, 0.15 },      // T21 - T95
+       { 159, 0.08 },
+       { 255, 0.06 },
+       { 319, 0.04 },
+       { 511, 0.025 },
+       { 639, 0.015 },
+    };
+    constexpr double MIN_THREAD_GAIN = 0.6;
+    constexpr int    MAX_THREADS     = 64;
+
+    // Unknown resolutions use the T319 figures.
+    double f = 0.04;
+    size_t digits = horiz_resolution.find_first_of("0123456789");
+    if (digits != std::string::npos) {
+       int res = std::atoi(horiz_resolution.c_str() + digits);
+       for (const auto& entry : serial_fraction) {
+          if (res >= entry.first) f = entry.second;
+       }
+    }
+
+    // Amdahl speedup on n threads.
+    auto speedup = [f](int n) { return n / (1.0 + f * (n - 1)); };
+
+    int n = 1;
+    while (n < MAX_THREADS && speedup(n + 1) - speedup(n) >= MIN_THREAD_GAIN) {
+       n++;
+    }
+    return n;
+}
+
+
+int choose_nthreads(int requested, int free_cores, const std::string& horiz_resolution) {
+    // The model configurations are not run on a single thread, unless the workunit asks for it.
+    const int min_nthreads = std::min(requested, 2);
+    int nthreads = requested;
+
+    int useful = max_useful_threads(horiz_resolution);
+    if (nthreads > useful) {
+       std::cerr << "Thread count: " << nthreads << " requested, parallel efficiency at resolution "
+                 << (horiz_resolution.empty() ? "(unknown)" : horiz_resolution) << " drops after " << useful << " threads\n";
+       nthreads = useful;
+    }
+    if (free_cores > 0 && nthreads > free_cores) {
+       std::cerr << "Thread count: only " << free_cores << " physical cores free of other bound tasks\n";
+       nthreads = free_cores;
+    }
+    if (nthreads < min_nthreads) {
+       std::cerr << "Thread count: " << nthreads << " is too low for this configuration, using " << min_nthreads << '\n';
+       nthreads = min_nthreads;
+    }
+    std::cerr << "Thread count: using " << nthreads << " threads (requested " << requested << ")\n";
+    return nthreads;
+}
+
+
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+       if (range.find_first_of("0123456789") == std::string::npos) continue;
+       char* end = nullptr;
+       long first = strtol(range.c_str(), &end, 10);
+       long last  = first;
+       if (*end == '-') {
+          last = strtol(end + 1, &end, 10);
+       }
+       for (long cpu = first; cpu <= last && cpu - first < 65536; cpu++) {
+          cpus.push_back((int) cpu);
+       }
+    }
+    return cpus;
+}
+
+
+std::string omp_places(const std::vector<int>& cpus) {
+    std::string places;
+    for (auto cpu : cpus) {
+       if (!places.empty()) places += ",";
+       places += "{" + std::to_string(cpu) + "}";
+    }
+    return places;
+}
+
+
+bool read_topology(host_topology& topo, const std::string& sysfs) {
+    topo.cpus.clear();
+
+    std::vector<int> cpuset = process_cpuset();
+    if (cpuset.empty()) {
+       return false;
+    }
+
+    // NUMA node of each cpu; hosts without NUMA support have no node directory, all cpus are in node 0.
+    std::map<int, int> cpu_node;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(fs::path(sysfs) / "node", ec)) {
+       std::string name = entry.path().filename().string();
+       if (name.rfind("node", 0) != 0 || name.find_first_not_of("0123456789", 4) != std::string::npos || name.size() == 4) continue;
+       int node = std::stoi(name.substr(4));
+       for (auto cpu : parse_cpu_list(read_sysfs_line(entry.path() / "cpulist"))) {
+          cpu_node[cpu] = node;
+       }
+    }
+
+    // Physical cores are identified by (package, core_id).
+    std::map<std::pair<int, int>, int> core_index;
+    for (auto cpu : cpuset) {
+       fs::path topology = fs::path(sysfs) / "cpu" / ("cpu" + std::to_string(cpu)) / "topology";
+       cpu_info info;
+       info.cpu     = cpu;
+       info.package = read_sysfs_int(topology / "physical_package_id", 0);
+       int core_id  = read_sysfs_int(topology / "core_id", cpu);
+       auto key     = std::make_pair(info.package, core_id);
+       if (core_index.find(key) == core_index.end()) {
+          int next = (int) core_index.size();
+          core_index[key] = next;
+       }
+       info.core = core_index[key];
+       info.node = cpu_node.count(cpu) ? cpu_node[cpu] : 0;
+       topo.cpus.push_back(info);
+    }
+    return true;
+}
+
+
+std::set<int> cpus_bound_by_others(const std::string& comm_prefix) {
+    std::set<int> busy;
+#if defined(__linux__)
+    std::vector<int> all = process_cpuset();
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator("/proc", ec)) {
+       std::string name = entry.path().filename().string();
+       if (name.find_first_not_of("0123456789") != std::string::npos) continue;
+       pid_t pid = (pid_t) std::stol(name);
+       if (pid == getpid()) continue;
+
+       if (read_sysfs_line(entry.path() / "comm").rfind(comm_prefix, 0) != 0) continue;
+
+       cpu_set_t mask;
+       CPU_ZERO(&mask);
+       if (sched_getaffinity(pid, sizeof(mask), &mask) != 0) continue;
+
+       // Only processes that have been bound to some of our cpus, not free to run anywhere.
+       std::vector<int> bound;
+       for (auto cpu : all) {
+          if (CPU_ISSET(cpu, &mask)) bound.push_back(cpu);
+       }
+       if (bound.size() < all.size()) {
+          busy.insert(bound.begin(), bound.end());
+       }
+    }
+#endif
+    return busy;
+}
+
+
+std::vector<int> plan_placement(const host_topology& topo, int nthreads, const std::set<int>& busy) {
+    if (nthreads < 1) return {};
+
+    // A core is free if none of its logical cpus are used by another bound process.
+    std::set<int> busy_cores;
+    for (const auto& c : topo.cpus) {
+       if (busy.count(c.cpu)) busy_cores.insert(c.core);
+    }
+
+    // First free logical cpu of each free physical core, per NUMA node.
+    std::map<int, std::vector<int>> node_cpus;
+    std::set<int> used_cores;
+    for (const auto& c : topo.cpus) {
+       if (busy_cores.count(c.core) || used_cores.count(c.core)) continue;
+       used_cores.insert(c.core);
+       node_cpus[c.node].push_back(c.cpu);
+    }
+
+    // Prefer the node with the fewest free cores that still fits all the threads, to leave
+    // larger nodes for other tasks.
+    const std::vector<int>* best = nullptr;
+    for (const auto& node : node_cpus) {
+       if ((int) node.second.size() >= nthreads && (best == nullptr || node.second.size() < best->size())) {
+          best = &node.second;
+       }
+    }
+    if (best != nullptr) {
+       return std::vector<int>(best->begin(), best->begin() + nthreads);
+    }
+
+    // Otherwise span the nodes, still one thread per physical core.
+    std::vector<int> cpus;
+    for (const auto& node : node_cpus) {
+       for (auto cpu : node.second) {
+          if ((int) cpus.size() < nthreads) cpus.push_back(cpu);
+       }
+    }
+    if ((int) cpus.size() < nthreads) {
+       cpus.clear();
+    }
+    return cpus;
+}
@@ -0,0 +1,55 @@
+//
+// Host CPU topology and thread placement for the model, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+
+
+// A logical cpu the model is allowed to run on.
+struct cpu_info {
+    int cpu     = 0;      // logical cpu number
+    int core    = 0;      // physical core, unique over the host
+    int package = 0;      // socket
+    int node    = 0;      // NUMA node
+};
+
+// Logical cpus in this process's cpuset, with their place in the host topology.
+struct host_topology {
+    std::vector<cpu_info> cpus;     // ordered by cpu number
+
+    int physical_cores(const std::set<int>& busy = {}) const;   // cores with none of their cpus in 'busy'
+};
+
+// Read the topology of the cpus in this process's cpuset from sysfs (normally /sys/devices/system).
+bool read_topology(host_topology&, const std::string& sysfs = "/sys/devices/system");
+
+// Logical cpus that other running processes, whose name starts with comm_prefix, are bound to.
+// Used to avoid placing the model on the same cores as other model tasks.
+std::set<int> cpus_bound_by_others(const std::string& comm_prefix);
+
+// Choose one logical cpu per thread, each on a different physical core not in 'busy',
+// all within one NUMA node if possible. Returns an empty list if there are not enough free cores,
+// in which case the threads should be left to the operating system.
+std::vector<int> plan_placement(const host_topology&, int nthreads, const std::set<int>& busy = {});
+
+// Largest number of model threads worth using at this horizontal resolution (e.g. "159", "TL255"),
+// from the model's parallel efficiency: a thread is only added while it gives at least
+// MIN_THREAD_GAIN of a core's worth of extra throughput.
+int max_useful_threads(const std::string& horiz_resolution);
+
+// Choose the number of model threads from the requested number (workunit or app_config), the free
+// physical cores (0 if unknown) and the resolution. Never more than requested, as the client has only
+// reserved that many cpus, and not less than 2 unless fewer were requested. The reasoning is logged.
+int choose_nthreads(int requested, int free_cores, const std::string& horiz_resolution);
+
+// Parse a kernel cpu list, e.g. "0-3,8,10-11".
+std::vector<int> parse_cpu_list(const std::string&);
+
+// OpenMP places for the given cpus, one place per thread, e.g. "{0},{2},{4}".
+std::string omp_places(const std::vector<int>&);
@@ -0,0 +1,188 @@
+//
+// Timing of the control code's work, as counters and a timeline, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <unistd.h>
+
+#include "CPDN_trace.h"
+
+namespace {
+    constexpr std::size_t RING_SIZE = 65536;     // power of 2, 88 bytes a slot so about 5.5 MiB; a few days of events at the usual rates
+    constexpr std::size_t NAME_SIZE = 40;
+
+    // A slot in the ring. seq is the event number + 1 once the event has been written, 0 while it's being
+    // written, so a reader can tell whether it copied a whole event (as a seqlock).
+    struct trace_event {
+        std::atomic<std::uint64_t> seq{0};
+        char          name[NAME_SIZE];
+        const char*   category;
+        char          phase;                     // Chrome trace phases: 'X' complete, 'i' instant, 'C' counter
+        std::uint32_t tid;
+        std::uint64_t ts_us;
+        std::uint64_t dur_us;
+        std::int64_t  value;
+    };
+
+    // A copy of an event, read from the ring.
+    struct event_copy {
+        std::string   name;
+        const char*   category;
+        char          phase;
+        std::uint32_t tid;
+        std::uint64_t ts_us, dur_us;
+        std::int64_t  value;
+    };
+
+    trace_event                 ring[RING_SIZE];
+    std::atomic<std::uint64_t>  next_event{0};
+    std::atomic<bool>           enabled{true};
+    std::atomic<std::uint32_t>  next_tid{0};
+    const auto                  start_time = std::chrono::steady_clock::now();
+
+    std::uint32_t thread_number() {
+        thread_local std::uint32_t tid = next_tid++;
+        return tid;
+    }
+
+    void record(const std::string& name, const char* category, char phase, std::uint64_t ts_us, std::uint64_t dur_us, std::int64_t value) {
+        if (!enabled.load(std::memory_order_relaxed)) return;
+
+        std::uint64_t n = next_event.fetch_add(1, std::memory_order_relaxed);
+        trace_event& e = ring[n & (RING_SIZE - 1)];
+        e.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::size_t length = std::min(name.size(), NAME_SIZE - 1);
+        std::memcpy(e.name, name.data(), length);
+        e.name[length] = '\0';
+        e.category = category;
+        e.phase    = phase;
+        e.tid      = thread_number();
+        e.ts_us    = ts_us;
+        e.dur_us   = dur_us;
+        e.value    = value;
+        e.seq.store(n + 1, std::memory_order_release);
+    }
+
+    // The events still in the ring, oldest first. Events being written as they're read are left out.
+    std::vector<event_copy> snapshot(std::uint64_t& dropped) {
+        std::uint64_t last  = next_event.load(std::memory_order_acquire);
+        std::uint64_t first = (last > RING_SIZE) ? last - RING_SIZE : 0;
+        dropped = first;
+
+        std::vector<event_copy> events;
+        events.reserve(last - first);
+        for (std::uint64_t n = first; n < last; n++) {
+            const trace_event& e = ring[n & (RING_SIZE - 1)];
+            if (e.seq.load(std::memory_order_acquire) != n + 1) continue;
+            event_copy copy { std::string(e.name, strnlen(e.name, NAME_SIZE)), e.category, e.phase, e.tid, e.ts_us, e.dur_us, e.value };
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (e.seq.load(std::memory_order_relaxed) == n + 1) events.push_back(std::move(copy));
+        }
+        return events;
+    }
+
+    std::string json_string(const std::string& s) {
+        std::string out = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') out += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20) out += c;
+        }
+        return out + "\"";
+    }
+}
+
+
+std::uint64_t trace_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+void trace_complete(const std::string& name, const char* category, std::uint64_t start_us, std::uint64_t dur_us) {
+    record(name, category, 'X', start_us, dur_us, 0);
+}
+
+void trace_instant(const std::string& name, const char* category) {
+    record(name, category, 'i', trace_now_us(), 0, 0);
+}
+
+void trace_counter(const std::string& name, std::int64_t value) {
+    record(name, "counter", 'C', trace_now_us(), 0, value);
+}
+
+void trace_set_enabled(bool on) {
+    enabled = on;
+}
+
+
+void trace_summary(std::ostream& out) {
+    struct totals {
+        std::uint64_t count = 0, total_us = 0, max_us = 0;
+        std::int64_t  last = 0, max = 0;
+    };
+    std::uint64_t dropped;
+    auto events = snapshot(dropped);
+
+    std::map<std::pair<std::string, std::string>, totals> by_name;
+    for (const auto& e : events) {
+        totals& t = by_name[{e.category, e.name}];
+        t.max = (t.count == 0) ? e.value : std::max(t.max, e.value);
+        t.count++;
+        t.total_us += e.dur_us;
+        t.max_us    = std::max(t.max_us, e.dur_us);
+        t.last      = e.value;
+    }
+
+    out << "TRACE wall_ms=" << trace_now_us() / 1000 << " events=" << events.size() << " dropped=" << dropped << '\n';
+    for (const auto& entry : by_name) {
+        const totals& t = entry.second;
+        out << "TRACE category=" << entry.first.first << " name=" << json_string(entry.first.second) << " count=" << t.count;
+        if (entry.first.first == "counter") {
+            out << " last=" << t.last << " max=" << t.max << '\n';
+        }
+        else {
+            out << " total_ms=" << t.total_us / 1000 << " max_ms=" << t.max_us / 1000 << '\n';
+        }
+    }
+    out.flush();
+}
+
+
+bool trace_write_chrome(const std::string& path) {
+    std::uint64_t dropped;
+    auto events = snapshot(dropped);
+
+    std::ofstream out(path);
+    out << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":" << dropped << "},\"traceEvents\":[";
+    const long pid = getpid();
+    bool first = true;
+    for (const auto& e : events) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":" << json_string(e.name) << ",\"cat\":" << json_string(e.category) << ",\"ph\":\"" << e.phase
+            << "\",\"ts\":" << e.ts_us << ",\"pid\":" << pid << ",\"tid\":" << e.tid;
+        if (e.phase == 'X') out << ",\"dur\":" << e.dur_us;
+        if (e.phase == 'i') out << ",\"s\":\"t\"";
+        if (e.phase == 'C') out << ",\"args\":{\"value\":" << e.value << "}";
+        out << "}";
+    }
+    out << "\n]}\n";
+    out.close();
+    return !out.fail();
+}
+
+
+ScopedTimer::ScopedTimer(std::string name, const char* category)
+    : name_(std::move(name)), category_(category), start_us_(trace_now_us()) {}
+
+ScopedTimer::~ScopedTimer() {
+    trace_complete(name_, category_, start_us_, trace_now_us() - start_us_);
+}
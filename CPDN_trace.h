@@ -0,0 +1,50 @@
+//
+// Timing of the control code's work, as counters and a timeline, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <ostream>
+
+
+// Events are recorded from any thread into a fixed size in-memory ring without locking. Once the ring
+// is full the oldest events are overwritten. Names longer than 39 characters are truncated.
+// Times are in microseconds since the control code started. Categories must be string literals.
+
+std::uint64_t trace_now_us();
+
+void trace_complete(const std::string& name, const char* category, std::uint64_t start_us, std::uint64_t dur_us);
+void trace_instant(const std::string& name, const char* category);
+void trace_counter(const std::string& name, std::int64_t value);
+
+// Recording is on by default.
+void trace_set_enabled(bool);
+
+// Summary of the events in the ring, one line per name, starting 'TRACE' with key=value fields.
+// Names are quoted as JSON strings.
+void trace_summary(std::ostream&);
+
+// Write the events in the ring as a Chrome trace-event JSON file (chrome://tracing, Perfetto).
+bool trace_write_chrome(const std::string& path);
+
+
+// Records the time from its construction to its destruction as a complete event.
+class ScopedTimer {
+  public:
+    ScopedTimer(std::string name, const char* category);
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    std::uint64_t elapsed_ms() const { return (trace_now_us() - start_us_) / 1000; }
+
+  private:
+    std::string   name_;
+    const char*   category_;
+    std::uint64_t start_us_;
+};
@@ -0,0 +1,103 @@
+//
+// Background packaging of the model output into upload files for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#include <iostream>
+
+#include "CPDN_upload.h"
+#include "CPDN_control_code.h"
+#include "CPDN_trace.h"
+
+
+UploadWorker::UploadWorker(size_t max_jobs, cache_hints hints) : max_jobs_(max_jobs > 0 ? max_jobs : 1), hints_(hints) {
+    thread_ = std::thread(&UploadWorker::run, this);
+}
+
+UploadWorker::~UploadWorker() {
+    {
+       std::lock_guard<std::mutex> lock(mutex_);
+       if (!queue_.empty()) {
+          std::cerr << "Upload worker stopping, " << queue_.size() << " upload files not created\n";
+       }
+       queue_.clear();
+       stop_ = true;
+       cancel_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+bool UploadWorker::submit(upload_job job) {
+    {
+       std::lock_guard<std::mutex> lock(mutex_);
+       if (queue_.size() + (busy_ ? 1 : 0) >= max_jobs_) {
+          return false;
+       }
+       queue_.push_back(std::move(job));
+    }
+    cv_.notify_all();
+    return true;
+}
+
+std::vector<upload_result> UploadWorker::completed() {
+    std::vector<upload_result> results;
+    std::lock_guard<std::mutex> lock(mutex_);
+    results.swap(done_);
+    return results;
+}
+
+void UploadWorker::drain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return queue_.empty() && !busy_; });
+}
+
+size_t UploadWorker::pending() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size() + (busy_ ? 1 : 0);
+}
+
+void UploadWorker::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+       cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+       if (stop_) break;
+
+       upload_result result;
+       result.job = std::move(queue_.front());
+       queue_.pop_front();
+       busy_ = true;
+       lock.unlock();
+
+       // An upload interval with no model output still uses up an upload file number.
+       if (result.job.files.empty()) {
+          result.ok = true;
+       }
+       else {
+          std::cerr << "Compressing upload file: " << result.job.zip_file << '\n';
+          ScopedTimer timer("upload file", "compress");
+          cpdn_zip_control control;
+          control.cancel = &cancel_;
+          control.write_behind = hints_.write_behind;
+          control.progress = [this](std::uint64_t, std::uint64_t) {
+             while (paused_ && !cancel_) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+             }
+          };
+          result.ok = cpdn_zip(result.job.zip_file, result.job.files, &control) && fsync_file(result.job.zip_file);
+          result.msecs = timer.elapsed_ms();
+          std::cerr << "Time taken to compress upload file: " << result.msecs << " ms\n";
+
+          if (result.ok && hints_.drop) {
+             drop_cached(result.job.zip_file);
+             for (const auto& file : result.job.files) drop_cached(file);
+          }
+       }
+
+       lock.lock();
+       done_.push_back(std::move(result));
+       busy_ = false;
+       cv_.notify_all();
+    }
+}
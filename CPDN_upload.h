@@ -0,0 +1,75 @@
+//
+// Background packaging of the model output into upload files for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <filesystem>
+
+#include "CPDN_cache.h"
+
+
+// An upload file to be created from model output files.
+struct upload_job {
+    int         number = 0;             // upload file number
+    int         last_upload = 0;        // model time (secs) of the last output in this upload
+    std::string zip_file;               // physical path of the zip file to create
+    std::string logical_name;           // BOINC logical name of the upload file, empty if standalone
+    std::vector<std::filesystem::path> files;     // files to add to the zip
+};
+
+// A job the worker has finished with.
+struct upload_result {
+    upload_job job;
+    bool       ok = false;
+    long       msecs = 0;               // time taken to compress
+};
+
+// Compresses upload files on a background thread so the main loop can keep monitoring the model
+// and servicing the BOINC client. The worker only creates the zip file; it does not delete the
+// input files or call the BOINC API, which isn't thread safe. Those are done by the main thread
+// when it commits a completed job, see completed().
+//
+// Once an upload file is written, it and the files in it are dropped from the page cache (if hints.drop),
+// so model output doesn't push the model's own data out of memory.
+//
+// Jobs are done in the order they are submitted. The queue is bounded, submit() returns false
+// if it is full and the caller should try again later.
+class UploadWorker {
+  public:
+    explicit UploadWorker(size_t max_jobs, cache_hints hints = cache_hints());
+    ~UploadWorker();        // abandons queued jobs and cancels the current one
+
+    UploadWorker(const UploadWorker&) = delete;
+    UploadWorker& operator=(const UploadWorker&) = delete;
+
+    bool submit(upload_job job);
+    std::vector<upload_result> completed();      // finished jobs since the last call, does not block
+    void drain();                                // wait until all submitted jobs are finished
+    size_t pending();                            // jobs queued or in progress
+    void pause(bool paused) { paused_ = paused; }  // holds the job in progress, e.g. while the task is suspended
+
+  private:
+    void run();
+
+    size_t                    max_jobs_;
+    cache_hints               hints_;
+    std::deque<upload_job>    queue_;
+    std::vector<upload_result> done_;
+    bool                      busy_ = false;
+    bool                      stop_ = false;
+    std::atomic<bool>         cancel_{false};   // stops the job in progress
+    std::atomic<bool>         paused_{false};   // holds the job in progress until cleared
+    std::mutex                mutex_;
+    std::condition_variable   cv_;
+    std::thread               thread_;
+};
@@ -0,0 +1,358 @@
+//
+// Benchmark of the control code's own overhead, running it standalone with the model simulator
+// (oifs_43r3_test.exe), for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+// The slot and project directories are set up as oifs_test_setup.py does, with fort.4 set from the options,
+// then the control code is run and watched from outside. Results are written as JSON:
+//    supervisor_cpu_s   cpu time of the control code process itself (all its threads), not the model's
+//    task_wall_s        control code start to exit
+//    model_wall_s       the model creating ifs.stat to it closing NODE.001_01
+//    overhead_s         task_wall_s - model_wall_s: staging before the model starts and packaging after it ends
+//    harvest_ms         latency from the model closing each ICM file to the control code moving it out of the slot
+// plus the control code's own TRACE (critical sections, compression, moves, staging) and THROUGHPUT summaries.
+//
+// Usage: bench_control --ctl <control code exe> [--model oifs_43r3_test.exe] [--steps 24] [--step-secs 2]
+//                      [--output-steps 1] [--output-kb 4] [--upload-steps 12] [--restart-steps 12] [--input-mb 1]
+//                      [--dir path] [--label text] [--json file] [--keep]
+//
+//   --steps          model steps (the run is one day, so 86400 must be a multiple of it)
+//   --step-secs      wall time of each model step
+//   --output-steps   steps between model output (NFRPOS), each output is 3 ICM files of --output-kb
+//   --upload-steps   steps between upload files (UPLOAD_INTERVAL)
+//   --restart-steps  steps between restarts (NFRRES)
+//   --input-mb       size of each of the 3 input files staged at the start (ifsdata, ic_ancil, climate_data)
+//   --keep           keep the run directory, e.g. to look at ctl.out
+
+#include "cpdn_zip.h"
+#include "zip/bench_util.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+
+namespace fs = std::filesystem;
+using bench_clock = std::chrono::steady_clock;
+
+namespace {
+
+    struct options {
+        fs::path    ctl, model = "oifs_43r3_test.exe", dir = fs::temp_directory_path() / "bench_control";
+        int         steps = 24, output_steps = 1, upload_steps = 12, restart_steps = 12;
+        double      step_secs = 2, output_kb = 4, input_mb = 1;
+        bool        keep = false;
+    };
+
+    double secs_between(bench_clock::time_point a, bench_clock::time_point b) {
+        return std::chrono::duration<double>(b - a).count();
+    }
+
+    void write_file(const fs::path& path, const std::string& content) {
+        std::ofstream out(path, std::ios::binary);
+        out << content;
+    }
+
+    std::string random_bytes(std::size_t nbytes, std::mt19937& rng) {
+        std::string bytes(nbytes, '\0');
+        for (auto& byte : bytes) byte = static_cast<char>(rng());
+        return bytes;
+    }
+
+    // A BOINC link file in the slot and the zip it points to, containing one file.
+    bool write_input(const fs::path& slot, const std::string& link, const std::string& zip_name,
+                     const fs::path& content_file) {
+        write_file(slot / link, ">" + zip_name + "<\n");
+        return cpdn_zip(slot / zip_name, { content_file });
+    }
+
+    bool setup(const options& opt, int utstep) {
+        fs::remove_all(opt.dir);
+        fs::path projects = opt.dir / "projects", slot = opt.dir / "slots", inputs = opt.dir / "inputs";
+        for (const auto& dir : { projects, slot, inputs }) fs::create_directories(dir);
+        std::mt19937 rng(1234);
+
+        write_file(inputs / "oifs_43r3_app_1.00_x86_64-pc-linux-gnu", random_bytes(4000, rng));
+        if (!cpdn_zip(projects / "oifs_43r3_app_1.00_x86_64-pc-linux-gnu.zip", { inputs / "oifs_43r3_app_1.00_x86_64-pc-linux-gnu" })) return false;
+
+        write_file(slot / "init_data.xml",
+            "<app_init_data>\n<major_version>0</major_version>\n<minor_version>0</minor_version>\n<release>0</release>\n"
+            "<app_version>000</app_version>\n<hostid>0</hostid>\n<app_name>openifs</app_name>\n<project_preferences></project_preferences>\n"
+            "<project_dir>" + fs::absolute(projects).string() + "</project_dir>\n<boinc_dir>" + fs::absolute(opt.dir).string() + "</boinc_dir>\n"
+            "<wu_name>oifs_43r3_NNNN_yyyymmddhh_1_d000_0</wu_name>\n<shm_key>0</shm_key>\n<slot>0</slot>\n"
+            "<checkpoint_period>60.000000</checkpoint_period>\n<fraction_done_start>0.000000</fraction_done_start>\n"
+            "<fraction_done_end>1.000000</fraction_done_end>\n</app_init_data>\n");
+
+        std::ostringstream fort4;
+        fort4 << "!WU_TEMPLATE_VERSION=43r3-seasonal-20250801\n!EXPTID=NNNN\n!UNIQUE_MEMBER_ID=1353\n"
+              << "!IFSDATA_FILE=ifsdata_0\n!IC_ANCIL_FILE=ic_ancil_0\n!CLIMATE_DATA_FILE=clim_data_0\n"
+              << "!HORIZ_RESOLUTION=159\n!VERT_RESOLUTION=91\n!GRID_TYPE=l_2\n"
+              << "!UPLOAD_INTERVAL=" << opt.upload_steps << "\n!TRICKLE_UPLOAD_FREQUENCY=1\n!TSTEP=" << utstep << "\n"
+              << "&NAMCT0\n UTSTEP=" << utstep << ".0,\n NFRPOS=" << opt.output_steps << ",\n NFRRES=" << opt.restart_steps
+              << ",\n CUSTOP='t" << opt.steps << "',\n/\n";
+        write_file(inputs / "fort.4", fort4.str());
+        write_file(slot / "oifs_43r3_NNNN_yyyymmddhh_1_d000_0.zip", ">jf_namelist<\n");
+        if (!cpdn_zip(slot / "jf_namelist", { inputs / "fort.4" })) return false;
+
+        auto input_bytes = static_cast<std::size_t>(opt.input_mb * 1024 * 1024);
+        for (const char* name : { "jf_ic_ancil", "jf_ifsdata", "jf_clim_data" }) {
+            write_file(inputs / name, random_bytes(input_bytes, rng));
+        }
+        if (!write_input(slot, "ic_ancil_0.zip", "jf_ic_ancil", inputs / "jf_ic_ancil") ||
+            !write_input(slot, "ifsdata_0.zip", "jf_ifsdata", inputs / "jf_ifsdata") ||
+            !write_input(slot, "clim_data_0.zip", "jf_clim_data", inputs / "jf_clim_data")) return false;
+
+        fs::copy_file(opt.model, slot / "oifs_43r3_test.exe");
+        fs::copy_file(opt.ctl, projects / "oifs_ctl");
+        return true;
+    }
+
+    // utime, stime, cutime & cstime from /proc/<pid>/stat, in clock ticks. Works for a zombie process.
+    bool read_cpu_ticks(pid_t pid, unsigned long long ticks[4]) {
+        std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+        std::string stat;
+        std::getline(in, stat);
+        auto close = stat.rfind(')');
+        if (close == std::string::npos) return false;
+        std::istringstream fields(stat.substr(close + 2));
+        std::string field;
+        for (int i = 3; i < 14 && fields >> field; i++) {}      // state (field 3) to cmajflt (field 13)
+        return static_cast<bool>(fields >> ticks[0] >> ticks[1] >> ticks[2] >> ticks[3]);
+    }
+
+    unsigned long long peak_rss_kb(pid_t pid) {
+        std::ifstream in("/proc/" + std::to_string(pid) + "/status");
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.compare(0, 6, "VmHWM:") == 0) return std::strtoull(line.c_str() + 6, nullptr, 10);
+        }
+        return 0;
+    }
+
+    // A summary line from the control code, 'TRACE category=move name="output step" count=24 ...',
+    // as a JSON object. Names are already JSON strings.
+    std::string summary_json(const std::string& line) {
+        std::string json = "{";
+        std::size_t pos = line.find(' ');
+        while (pos != std::string::npos && pos < line.size()) {
+            pos = line.find_first_not_of(' ', pos);
+            if (pos == std::string::npos) break;
+            auto equals = line.find('=', pos);
+            if (equals == std::string::npos) break;
+            std::string key = line.substr(pos, equals - pos), value;
+            pos = equals + 1;
+            if (pos < line.size() && line[pos] == '"') {
+                auto end = pos + 1;
+                while (end < line.size() && line[end] != '"') end += (line[end] == '\\') ? 2 : 1;
+                value = line.substr(pos, end + 1 - pos);
+                pos = end + 1;
+            }
+            else {
+                auto end = line.find(' ', pos);
+                value = line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+                pos = end;
+                char* num_end = nullptr;
+                std::strtod(value.c_str(), &num_end);
+                if (value.empty() || *num_end != '\0') value = "\"" + value + "\"";
+            }
+            json += (json.size() > 1 ? ", \"" : "\"") + key + "\": " + value;
+        }
+        return json + "}";
+    }
+
+    double percentile(std::vector<double> values, double p) {
+        if (values.empty()) return 0;
+        std::sort(values.begin(), values.end());
+        return values[static_cast<std::size_t>(p * (values.size() - 1))];
+    }
+}
+
+
+int main(int argc, char** argv) {
+    options opt;
+    bench_args args;
+    args.flags  = { { "--keep", [&]() { opt.keep = true; } } };
+    args.values = {
+        { "--ctl",           [&](const std::string& v) { opt.ctl = v; } },
+        { "--model",         [&](const std::string& v) { opt.model = v; } },
+        { "--steps",         [&](const std::string& v) { opt.steps = std::atoi(v.c_str()); } },
+        { "--step-secs",     [&](const std::string& v) { opt.step_secs = std::atof(v.c_str()); } },
+        { "--output-steps",  [&](const std::string& v) { opt.output_steps = std::atoi(v.c_str()); } },
+        { "--output-kb",     [&](const std::string& v) { opt.output_kb = std::atof(v.c_str()); } },
+        { "--upload-steps",  [&](const std::string& v) { opt.upload_steps = std::atoi(v.c_str()); } },
+        { "--restart-steps", [&](const std::string& v) { opt.restart_steps = std::atoi(v.c_str()); } },
+        { "--input-mb",      [&](const std::string& v) { opt.input_mb = std::atof(v.c_str()); } },
+        { "--dir",           [&](const std::string& v) { opt.dir = v; } },
+    };
+    int parse_code = parse_bench_args(argc, argv, "bench_control",
+        "Usage: bench_control --ctl <control code exe> [--model oifs_43r3_test.exe] [--steps 24] [--step-secs 2]\n"
+        "                     [--output-steps 1] [--output-kb 4] [--upload-steps 12] [--restart-steps 12] [--input-mb 1]\n"
+        "                     [--dir path] [--label text] [--json file] [--keep]\n", args);
+    if (parse_code >= 0) return parse_code;
+    if (opt.ctl.empty() || !fs::exists(opt.ctl) || !fs::exists(opt.model)) {
+        std::cerr << "bench_control: the control code (--ctl) and model simulator (--model) executables are needed\n";
+        return 1;
+    }
+    if (opt.steps <= 0 || 86400 % opt.steps != 0 || opt.output_steps <= 0 || opt.upload_steps <= 0 || opt.restart_steps <= 0) {
+        std::cerr << "bench_control: the steps must divide 86400 and the intervals must be positive\n";
+        return 1;
+    }
+    const int utstep = 86400 / opt.steps;
+    opt.ctl = fs::absolute(opt.ctl);
+    opt.model = fs::absolute(opt.model);
+    if (!setup(opt, utstep)) {
+        std::cerr << "bench_control: setting up the run in " << opt.dir << " failed\n";
+        return 1;
+    }
+    const fs::path slot = opt.dir / "slots";
+
+    // Watch the slot for the model's files being written and the control code moving them.
+    int inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, slot.c_str(), IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_DELETE) < 0) {
+        std::cerr << "bench_control: inotify failed: " << std::strerror(errno) << '\n';
+        return 1;
+    }
+
+    std::cerr << "bench_control: " << opt.steps << " steps of " << opt.step_secs << " secs in " << slot << '\n';
+    const auto start = bench_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (chdir(slot.c_str()) != 0) _exit(127);
+        int out = open("ctl.out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        setenv("OIFS_TEST_STEP_SECS", std::to_string(opt.step_secs).c_str(), 1);
+        setenv("OIFS_TEST_OUTPUT_BYTES", std::to_string(static_cast<long>(opt.output_kb * 1024)).c_str(), 1);
+        std::string ctl = (opt.dir / "projects" / "oifs_ctl").string();
+        execl(ctl.c_str(), ctl.c_str(), "yyyymmddhh", "EXPT", "NNNN", "d000", "0", "1", "oifs_43r3", "1", "1.00", (char*) nullptr);
+        _exit(127);
+    }
+    if (pid < 0) {
+        std::cerr << "bench_control: fork failed: " << std::strerror(errno) << '\n';
+        return 1;
+    }
+
+    std::map<std::string, bench_clock::time_point> closed;      // ICM files written by the model, not yet moved
+    std::vector<double> harvest_ms;
+    bench_clock::time_point model_start{}, model_end{};
+    unsigned long long peak_kb = 0;
+    alignas(inotify_event) char events[16 * 1024];
+
+    for (;;) {
+        siginfo_t info{};
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid) break;
+        peak_kb = std::max(peak_kb, peak_rss_kb(pid));
+
+        pollfd pfd{ inotify_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        auto now = bench_clock::now();
+        ssize_t len;
+        while ((len = read(inotify_fd, events, sizeof(events))) > 0) {
+            for (char* p = events; p < events + len; ) {
+                auto* event = reinterpret_cast<inotify_event*>(p);
+                p += sizeof(inotify_event) + event->len;
+                if (event->len == 0) continue;
+                std::string name = event->name;
+
+                if (name == "ifs.stat" && (event->mask & IN_CREATE) && model_start == bench_clock::time_point{}) model_start = now;
+                if (name == "NODE.001_01" && (event->mask & IN_CLOSE_WRITE)) model_end = now;
+                if (name.compare(0, 3, "ICM") != 0) continue;
+
+                if (event->mask & IN_CLOSE_WRITE) {
+                    closed[name] = now;
+                }
+                else if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+                    auto file = closed.find(name);
+                    if (file != closed.end()) {
+                        harvest_ms.push_back(secs_between(file->second, now) * 1000);
+                        closed.erase(file);
+                    }
+                }
+            }
+        }
+    }
+    const auto end = bench_clock::now();
+
+    // The control code has exited but not been reaped, so its cpu times can still be read.
+    unsigned long long ticks[4] = { 0, 0, 0, 0 };
+    read_cpu_ticks(pid, ticks);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    close(inotify_fd);
+    const double tick = static_cast<double>(sysconf(_SC_CLK_TCK));
+    const double supervisor_cpu = (ticks[0] + ticks[1]) / tick, model_cpu = (ticks[2] + ticks[3]) / tick;
+    const int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+    // The control code's own summaries and upload queue stalls, from its stderr.
+    std::vector<std::string> trace, throughput;
+    int queue_full = 0, upload_files = 0;
+    {
+        std::ifstream log(slot / "ctl.out");
+        std::string line;
+        while (std::getline(log, line)) {
+            if (line.compare(0, 6, "TRACE ") == 0) trace.push_back(summary_json(line));
+            else if (line.compare(0, 11, "THROUGHPUT ") == 0) throughput.push_back(summary_json(line));
+            else if (line.find("Upload queue is full") != std::string::npos) queue_full++;
+        }
+    }
+    for (const auto& entry : fs::directory_iterator(opt.dir / "projects")) {
+        if (entry.path().extension() == ".zip" && entry.path().filename().string().compare(0, 10, "oifs_43r3_") == 0 &&
+            entry.path().filename() != "oifs_43r3_app_1.00_x86_64-pc-linux-gnu.zip") upload_files++;
+    }
+
+    const double task_wall = secs_between(start, end);
+    const bool model_ran = model_start != bench_clock::time_point{} && model_end != bench_clock::time_point{};
+    const double model_wall = model_ran ? secs_between(model_start, model_end) : 0;
+    double harvest_mean = 0;
+    for (double ms : harvest_ms) harvest_mean += ms / harvest_ms.size();
+
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3)
+         << "{\n  \"benchmark\": \"bench_control\",\n  \"label\": " << json_string(args.label) << ",\n"
+         << "  \"config\": {\"steps\": " << opt.steps << ", \"step_secs\": " << opt.step_secs << ", \"output_steps\": " << opt.output_steps
+         << ", \"output_kb\": " << opt.output_kb << ", \"upload_steps\": " << opt.upload_steps << ", \"restart_steps\": " << opt.restart_steps
+         << ", \"input_mb\": " << opt.input_mb << "},\n"
+         << "  \"exit_code\": " << exit_code << ",\n"
+         << "  \"task_wall_s\": " << task_wall << ",\n"
+         << "  \"model_wall_s\": " << model_wall << ",\n"
+         << "  \"overhead_s\": " << (model_ran ? task_wall - model_wall : 0.0) << ",\n"
+         << "  \"startup_s\": " << (model_ran ? secs_between(start, model_start) : 0.0) << ",\n"
+         << "  \"finish_s\": " << (model_ran ? secs_between(model_end, end) : 0.0) << ",\n"
+         << "  \"supervisor_cpu_s\": " << supervisor_cpu << ",\n"
+         << "  \"supervisor_cpu_pct\": " << (task_wall > 0 ? 100 * supervisor_cpu / task_wall : 0.0) << ",\n"
+         << "  \"supervisor_cpu_ms_per_step\": " << 1000 * supervisor_cpu / opt.steps << ",\n"
+         << "  \"supervisor_peak_rss_kb\": " << peak_kb << ",\n"
+         << "  \"model_cpu_s\": " << model_cpu << ",\n"
+         << "  \"harvest_ms\": {\"files\": " << harvest_ms.size() << ", \"not_moved\": " << closed.size()
+         << ", \"mean\": " << harvest_mean << ", \"p50\": " << percentile(harvest_ms, 0.5) << ", \"p95\": " << percentile(harvest_ms, 0.95)
+         << ", \"max\": " << percentile(harvest_ms, 1.0) << "},\n"
+         << "  \"upload_files\": " << upload_files << ",\n"
+         << "  \"upload_queue_full\": " << queue_full << ",\n"
+         << "  \"throughput\": " << (throughput.empty() ? "null" : throughput.back()) << ",\n"
+         << "  \"trace\": [";
+    for (std::size_t i = 0; i < trace.size(); i++) json << (i ? ",\n    " : "\n    ") << trace[i];
+    json << "\n  ]\n}\n";
+
+    bool written = write_bench_json("bench_control", args.json, json.str());
+    if (!opt.keep) fs::remove_all(opt.dir);
+
+    if (exit_code != 0) std::cerr << "bench_control: the control code exited with " << exit_code << ", see ctl.out (use --keep)\n";
+    return exit_code == 0 && written ? 0 : 1;
+}
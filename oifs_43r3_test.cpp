@@ -3,10 +3,20 @@
 // Program to simulate an oifs_43r3 executable for testing purposes
 // This program has been written by Andy Bowery (Oxford University, 2023)
 
-// To build use: g++ oifs_43r3_test.cpp -std=c++17 -o oifs_43r3_test.exe
+// To build use: g++ oifs_43r3_test.cpp -std=c++17 -pthread -o oifs_43r3_test.exe
 
 // This program is run from the command line using: ./oifs_43r3_test.exe
 
+// The run is set from fort.4 in the current directory, if it's there: the timestep (UTSTEP), the run length
+// (CUSTOP), the output (NFRPOS) and restart (NFRRES) intervals and the resolution (!HORIZ_RESOLUTION).
+// Like the model, it writes ifs.stat with the step timings, the ICMGG, ICMSH & ICMUA output as GRIB-like
+// messages of 16-bit packed fields sized for the resolution, an rcf file at each restart step and the
+// NODE.001_01 log, and restarts from the step in rcf if it's there. For performance tests these can be set:
+//    OIFS_TEST_TIME_SCALE    model secs run per wall sec, e.g. 7200 runs a 1 hour step in 0.5 secs
+//    OIFS_TEST_STEP_SECS     wall time of a step, secs, overrides OIFS_TEST_TIME_SCALE (default 10)
+//    OIFS_TEST_OUTPUT_BYTES  size of each ICM output file, instead of the size for the resolution
+//    OIFS_TEST_CPU_THREADS   number of threads kept busy as the model's would be (default 0, just sleeps)
+
 #include <iostream>
 #include <iomanip>
 #include <ctime>
@@ -18,117 +28,287 @@
 #include <string>
 #include <chrono>
 #include <thread>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <time.h>
 
 using namespace std;
 using namespace std::chrono;
 
 
+// Value of a namelist variable in fort.4, e.g. ' NFRPOS=-6,' gives '-6'. Empty if it's not there.
+std::string namelist_value(const std::string& fort4, const std::string& key)
+{
+    std::ifstream in(fort4);
+    std::string line;
+    while (std::getline(in, line)) {
+       auto start = line.find_first_not_of(' ');
+       if (start == std::string::npos || line.compare(start, key.size(), key) != 0) continue;
+       auto equals = line.find('=', start + key.size());
+       if (equals == std::string::npos || line.find_first_not_of(' ', start + key.size()) != equals) continue;
+
+       std::string value = line.substr(equals + 1);
+       value.erase(std::remove_if(value.begin(), value.end(), [](char c) { return c == ',' || c == ' ' || c == '\''; }), value.end());
+       return value;
+    }
+    return "";
+}
+
+// Namelist intervals are model steps if positive, hours if negative.
+int interval_steps(const std::string& value, int utstep, int fallback)
+{
+    if (value.empty()) return fallback;
+    int interval = std::stoi(value);
+    if (interval < 0) interval = -interval * 3600 / utstep;
+    return interval > 0 ? interval : fallback;
+}
+
+
+// Grid points of the reduced Gaussian grid for the spectral truncation (linear grid), or near enough.
+long grid_points(int truncation)
+{
+    switch (truncation) {
+       case 159: return 35718;
+       case 255: return 88838;
+       case 319: return 138346;
+       case 399: return 213988;
+       case 511: return 348528;
+       default:  return std::lround(1.36 * (truncation + 1) * (truncation + 1));
+    }
+}
+
+// A GRIB-like message: the GRIB2 indicator section, a smooth field with some noise packed to 16 bits, then '7777'.
+void write_grib(std::ofstream& out, long nvalues, int field, int step)
+{
+    static std::uint32_t noise = 12345;
+    const std::uint64_t length = 16 + 2 * nvalues + 4;
+    std::string message("GRIB\0\0\0\2", 8);
+    for (int shift = 56; shift >= 0; shift -= 8) message += static_cast<char>(length >> shift);
+    message.reserve(length);
+
+    // The two waves are rotated on each point rather than calling sin for every one
+    const double k1 = 0.0007 * (field % 7 + 1), k2 = 0.013;
+    double s1 = std::sin(field), c1 = std::cos(field), s2 = std::sin(step * 0.05), c2 = std::cos(step * 0.05);
+    const double sk1 = std::sin(k1), ck1 = std::cos(k1), sk2 = std::sin(k2), ck2 = std::cos(k2);
+    for (long i = 0; i < nvalues; i++) {
+       noise = noise * 1103515245 + 12345;
+       double value = 0.5 + 0.35 * s1 + 0.1 * s2 + 0.001 * (noise >> 16) / 65536.0;
+       auto packed = static_cast<std::uint16_t>(std::clamp(value, 0.0, 1.0) * 65535);
+       message += static_cast<char>(packed >> 8);
+       message += static_cast<char>(packed);
+
+       double t = s1 * ck1 + c1 * sk1;  c1 = c1 * ck1 - s1 * sk1;  s1 = t;
+       t        = s2 * ck2 + c2 * sk2;  c2 = c2 * ck2 - s2 * sk2;  s2 = t;
+    }
+    message += "7777";
+    out.write(message.data(), message.size());
+}
+
+// Process cpu time, secs, including the busy threads
+double process_cpu()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The cumulative times in ifs.stat are minutes:seconds
+std::string min_sec(double secs)
+{
+    std::ostringstream out;
+    out << static_cast<long>(secs) / 60 << ':' << std::setw(2) << std::setfill('0') << static_cast<long>(secs) % 60;
+    return out.str();
+}
+
+// The time of day at the start of each ifs.stat line
+std::string clock_time()
+{
+    auto t = std::time(nullptr);
+    auto tm = *std::localtime(&t);
+    std::ostringstream out;
+    out << std::put_time(&tm, "%H:%M:%S");
+    return out.str();
+}
+
+
 int main()
 {
     std::string second_part, exptid = "EXPT";
     int iteration = 0;
     int iteration2 = 0;
-    int max_iter = 24;     // max number of timesteps  !! TODO: These need to come from a mock namelist !!!
+    int max_iter = 24;     // max number of timesteps
+    int utstep = 3600;     // model timestep, secs
+    int resolution = 159;  // spectral truncation
 
     int nfrres = 2; // restart interval
-    int upload_interval = 4;
+    int upload_interval = 4;   // output interval
 
     cerr << "Starting oifs_43r3_test" << std::endl;
 
     // Get the slots path (the current working path)
     std::string slot_path = std::filesystem::current_path();
 
-    std::string ifs_stat_file = slot_path + std::string("/ifs.stat");
-    std::ofstream ifs_stat_file_out(ifs_stat_file);
+    // The run as set in fort.4. CUSTOP is the run length: 't' steps, 'h' hours or 'd' days.
+    std::string fort4 = slot_path + "/fort.4";
+    if (std::filesystem::exists(fort4)) {
+       utstep = std::max(std::atoi(namelist_value(fort4, "UTSTEP").c_str()), 1);
+       std::string custop = namelist_value(fort4, "CUSTOP");
+       if (custop.size() > 1) {
+          int length = std::atoi(custop.c_str() + 1);
+          if (custop[0] == 't') max_iter = length;
+          else if (custop[0] == 'h') max_iter = length * 3600 / utstep;
+          else if (custop[0] == 'd') max_iter = length * 86400 / utstep;
+       }
+       upload_interval = interval_steps(namelist_value(fort4, "NFRPOS"), utstep, upload_interval);
+       nfrres          = interval_steps(namelist_value(fort4, "NFRRES"), utstep, nfrres);
+       std::string horiz = namelist_value(fort4, "!HORIZ_RESOLUTION");
+       if (!horiz.empty()) resolution = std::max(std::atoi(horiz.c_str()), 1);
+    }
 
-    auto t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
+    // Wall time of a step: set, or the timestep run faster by the time scale, or 10 secs
+    double step_secs = 10.0;
+    if (const char* env = std::getenv("OIFS_TEST_TIME_SCALE")) step_secs = utstep / std::max(std::atof(env), 1e-6);
+    if (const char* env = std::getenv("OIFS_TEST_STEP_SECS")) step_secs = std::atof(env);
+    const auto step_time = duration_cast<steady_clock::duration>(duration<double>(step_secs));
 
-    this_thread::sleep_until(system_clock::now() + seconds(10));
+    // The output files are 40 surface fields on the grid (ICMGG), 8 fields on 10 pressure levels (ICMUA)
+    // and 4 spectral fields on 10 levels plus 2 surface ones (ICMSH), unless the size is set.
+    const char* env = std::getenv("OIFS_TEST_OUTPUT_BYTES");
+    const long output_bytes = env ? std::atol(env) : 0;
+    const long npoints   = grid_points(resolution);
+    const long nspectral = (resolution + 1L) * (resolution + 2L);
+    struct icm_file { std::string prefix; int nfields; long nvalues; };
+    std::vector<icm_file> icm_files = { { "ICMGG", 40, npoints }, { "ICMSH", 42, nspectral }, { "ICMUA", 80, npoints } };
+    if (env) {
+       for (auto& icm : icm_files) { icm.nfields = 1; icm.nvalues = std::max(output_bytes - 20, 0L) / 2; }
+    }
 
-    while (iteration <= max_iter) {
+    env = std::getenv("OIFS_TEST_CPU_THREADS");
+    const int cpu_threads = env ? std::max(std::atoi(env), 0) : 0;
 
-       // At the end of every restart interval, write out the same line three times
-       if ( iteration % abs( nfrres ) == 0) {
-          iteration2 = 3;
-       } else {
-          iteration2 = 1;
+    // Restart from the step in rcf, as the model does
+    std::string rcf_file = slot_path + std::string("/rcf");
+    if (std::filesystem::exists(rcf_file)) {
+       std::ifstream rcf_in(rcf_file);
+       std::string line;
+       while (std::getline(rcf_in, line)) {
+          auto quote = line.find('"');
+          if (line.find("CSTEP") != std::string::npos && quote != std::string::npos) iteration = std::atoi(line.c_str() + quote + 1);
        }
+       cerr << "Restarting from step " << iteration << std::endl;
+    }
 
-       // Write to the ifs.stat file
-       for (auto i=0; i < iteration2; i++) {
-          if ( to_string(iteration).length() == 1) {
-             ifs_stat_file_out <<" "<< std::put_time(&tm, "%H:%M:%S") << " 0AAA00AAA STEPO       " << to_string(iteration) << std::endl;
-             cerr              <<" "<< std::put_time(&tm, "%H:%M:%S") << " 0AAA00AAA STEPO       " << to_string(iteration) << std::endl;
-          } else if ( to_string(iteration).length() == 2) {
-             ifs_stat_file_out <<" "<< std::put_time(&tm, "%H:%M:%S") << " 0AAA00AAA STEPO      " << to_string(iteration) << std::endl;
-             cerr              <<" "<< std::put_time(&tm, "%H:%M:%S") << " 0AAA00AAA STEPO      " << to_string(iteration) << std::endl;
-          }
-       }
+    long output_size = 0;
+    for (const auto& icm : icm_files) output_size += icm.nfields * (16 + 2 * icm.nvalues + 4);
+    cerr << "Steps: " << max_iter << " of " << utstep << " secs at T" << resolution << ", output of " << output_size
+         << " bytes every " << upload_interval << " steps, restart every " << nfrres << " steps, " << step_secs
+         << " secs per step, " << cpu_threads << " busy threads" << std::endl;
 
-       // Write out the ICM files if at the end of an upload_interval
-       if (iteration % upload_interval == 0 and iteration > 0) {
-          if ( to_string(iteration).length() == 1) {
-             second_part = exptid +"+"+ "00000" + to_string(iteration);
-          } else if ( to_string(iteration).length() == 2) {
-             second_part = exptid +"+"+ "0000" + to_string(iteration);
-          } else if ( to_string(iteration).length() == 3) {
-             second_part = exptid +"+"+ "000" + to_string(iteration);
+    // Keep the threads busy for the whole run, as the model's OpenMP threads would be
+    std::atomic<bool> finished(false);
+    std::vector<std::thread> burners;
+    for (int i = 0; i < cpu_threads; i++) {
+       burners.emplace_back([&finished]() {
+          volatile double x = 1.0;
+          while (!finished) {
+             for (int j = 0; j < 100000; j++) x = x * 1.0000001 + 1e-9;
           }
+       });
+    }
 
-          std::string ICMGG_file = slot_path + std::string("/ICMGG") + second_part;
-          std::string ICMSH_file = slot_path + std::string("/ICMSH") + second_part;
-          std::string ICMUA_file = slot_path + std::string("/ICMUA") + second_part;
+    std::string ifs_stat_file = slot_path + std::string("/ifs.stat");
+    std::ofstream ifs_stat_file_out(ifs_stat_file, iteration > 0 ? std::ios::app : std::ios::trunc);
+    std::ofstream NODE_file_out(slot_path + std::string("/NODE.001_01"), iteration > 0 ? std::ios::app : std::ios::trunc);
 
-          // Open the ICM file streams
-          std::ofstream ICMGG_file_out(ICMGG_file);
-          std::ofstream ICMSH_file_out(ICMSH_file);
-          std::ofstream ICMUA_file_out(ICMUA_file);
+    // The setup lines before the first step
+    auto start = steady_clock::now();
+    double start_cpu = process_cpu();
+    for (std::string setup : { "CNT4", "CNT3" }) {
+       double cpu = process_cpu() - start_cpu, wall = duration<double>(steady_clock::now() - start).count();
+       std::ostringstream line;
+       line << " " << clock_time() << " 000000000 " << setup << std::setw(9) << -999 << std::fixed << std::setprecision(3)
+            << std::setw(10) << cpu << std::setw(9) << cpu << std::setw(9) << wall << std::setw(7) << min_sec(cpu)
+            << std::setw(7) << min_sec(wall) << " 0.00000000000000E+00 0GB   0MB";
+       ifs_stat_file_out << line.str() << std::endl;
+       cerr              << line.str() << std::endl;
+    }
 
-          // Write to the ICMGG
-          for (auto j=0; j<4000; j++) { ICMGG_file_out << rand() % 10; };
-          ICMGG_file_out << std::endl;
+    auto step_start = steady_clock::now();
+    double step_cpu = process_cpu();
 
-          // Write to the ICMSH
-          for (auto j=0; j<4000; j++) { ICMSH_file_out << rand() % 10; };
-          ICMSH_file_out << std::endl;
+    while (iteration <= max_iter) {
 
-          // Write to the ICMUA
-          for (auto j=0; j<4000; j++) { ICMUA_file_out << rand() % 10; };
-          ICMUA_file_out << std::endl;
+       // Time delay for the step to run, the writes then add to it as they do in the model
+       this_thread::sleep_until(step_start + step_time);
 
-          // Close the ICM file streams
-          ICMGG_file_out.close();
-          ICMSH_file_out.close();
-          ICMUA_file_out.close();
+       // Write out the ICM files if at the end of an upload_interval, before the step is in ifs.stat
+       if (iteration % upload_interval == 0 and iteration > 0) {
+          std::ostringstream step;
+          step << std::setw(6) << std::setfill('0') << iteration;
+          second_part = exptid + "+" + step.str();
 
+          for (const auto& icm : icm_files) {
+             std::ofstream icm_file_out(slot_path + "/" + icm.prefix + second_part, std::ios::binary);
+             for (int field = 0; field < icm.nfields; field++) {
+                write_grib(icm_file_out, icm.nvalues, field, iteration);
+             }
+          }
        }
 
-       iteration = iteration + 1;
+       // The rcf file at each restart step, with the step and the model time as DDDDHHMM
+       if (iteration % nfrres == 0 and iteration > 0) {
+          long model_secs = static_cast<long>(iteration) * utstep;
+          std::ostringstream ctime;
+          ctime << std::setfill('0') << std::setw(4) << model_secs / 86400 << std::setw(2) << model_secs % 86400 / 3600
+                << std::setw(2) << model_secs % 3600 / 60;
+          std::ofstream rcf_file_out(rcf_file);
+          rcf_file_out << "&NAMRCF\n CSTEP=\"" << std::setw(8) << iteration << "\",\n CTIME=\"" << ctime.str()
+                       << "      \",\n/\n";
+       }
+
+       // The cpu, vector cpu & wall time columns of the step, the totals so far and the spectral norm
+       auto now = steady_clock::now();
+       double cpu = process_cpu();
+       double wall = duration<double>(now - step_start).count();
+       std::ostringstream timings;
+       timings << std::fixed << std::setprecision(3) << std::setw(10) << cpu - step_cpu << std::setw(9) << cpu - step_cpu
+               << std::setw(9) << wall << std::setw(7) << min_sec(cpu - start_cpu)
+               << std::setw(7) << min_sec(duration<double>(now - start).count()) << std::setprecision(14)
+               << " " << 0.18 + 0.001 * std::sin(iteration * 0.1) << "E-15 0GB   0MB";
+       step_start = now;
+       step_cpu   = cpu;
+
+       // At the end of every restart interval, write out the same line three times
+       if ( iteration % abs( nfrres ) == 0) {
+          iteration2 = 3;
+       } else {
+          iteration2 = 1;
+       }
+
+       // Write to the ifs.stat file
+       for (auto i=0; i < iteration2; i++) {
+          ifs_stat_file_out <<" "<< clock_time() << " 0AAA00AAA STEPO" << std::setw(8) << iteration << timings.str() << std::endl;
+          cerr              <<" "<< clock_time() << " 0AAA00AAA STEPO" << std::setw(8) << iteration << timings.str() << std::endl;
+       }
+       NODE_file_out << " NSTEP = " << std::setw(6) << iteration << "  STEP TIME (SECS) = " << std::fixed
+                     << std::setprecision(3) << wall << std::endl;
 
-       // Time delay to slow the program down to allow the main loop of the calling program to run
-       this_thread::sleep_until(system_clock::now() + seconds(10));
+       iteration = iteration + 1;
     }
 
+    finished = true;
+    for (auto& burner : burners) burner.join();
 
     // And finally write the last CNT0 line into the ifs.stat file
-    if ( to_string(iteration).length() == 1) {
-       ifs_stat_file_out <<" "<< std::put_time(&tm, "%H:%M:%S") << " 0AAA00AAA CNT0        " << to_string(iteration) << std::endl;
-       cerr              <<" "<< std::put_time(&tm, "%H:%M:%S") << " 0AAA00AAA CNT0        " << to_string(iteration) << std::endl;
-    } else if ( to_string(iteration).length() == 2) {
-       ifs_stat_file_out <<" "<< std::put_time(&tm, "%H:%M:%S") << " 0AAA00AAA CNT0       " << to_string(iteration) << std::endl;
-       cerr              <<" "<< std::put_time(&tm, "%H:%M:%S") << " 0AAA00AAA CNT0       " << to_string(iteration) << std::endl;
-    }
+    ifs_stat_file_out <<" "<< clock_time() << " 0AAA00AAA CNT0" << std::setw(9) << iteration << std::endl;
+    cerr              <<" "<< clock_time() << " 0AAA00AAA CNT0" << std::setw(9) << iteration << std::endl;
     ifs_stat_file_out.close();
 
-
-    // Produce the NODE file
-    std::string NODE_file = slot_path + std::string("/NODE.001_01");
-    std::ofstream NODE_file_out(NODE_file);
-    for (auto j=0; j<4000; j++) {
-      NODE_file_out << rand() % 10 << '\n';
-    }
-    NODE_file_out << std::endl;
+    // And the end of the NODE file
+    NODE_file_out << " END CNT0" << std::endl;
     NODE_file_out.close();
 
 }
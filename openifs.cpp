@@ -6,93 +6,63 @@
 //
 
 #include "CPDN_control_code.h"
+#include "CPDN_proc_stats.h"
+#include "CPDN_upload.h"
+#include "CPDN_topology.h"
+#include "CPDN_memory.h"
+#include "CPDN_cache.h"
+#include "CPDN_disk.h"
+#include "CPDN_trace.h"
+#include "CPDN_throughput.h"
+#include "openifs.h"
 
 
-// Set the required OpenIFS environment variables
-bool oifs_setenvs(const std::string& slot_path, const std::string& nthreads) {
-
-    // For memory safety, keep env strings static so they persist for the life of the program.
+// Set the required OpenIFS environment variables in the model's environment block
+void oifs_setenvs(std::vector<std::string>& env, const std::string& slot_path, const std::string& nthreads, const std::string& stacksize) {
 
     // Set the OIFS_DUMMY_ACTION environmental variable, this controls what OpenIFS does if it goes into a dummy subroutine
     // Possible values are: 'quiet', 'verbose' or 'abort'
-    if ( !set_env_var("OIFS_DUMMY_ACTION", "abort") ) {
-      std::cerr << "..Setting the OIFS_DUMMY_ACTION environmental variable failed" << std::endl;
-      return false;
-    }
+    set_env_var(env, "OIFS_DUMMY_ACTION", "abort");
 
     // Set the OMP_NUM_THREADS environmental variable; nthreads must be a positive integer string
-    if ( !set_env_var("OMP_NUM_THREADS", nthreads) ) {
-      std::cerr << "..Setting the OMP_NUM_THREADS environmental variable failed" << std::endl;
-      return false;
-    }
-    std::cerr << "Info: OMP_NUM_THREADS is set to: " << getenv("OMP_NUM_THREADS") << "\n";
+    set_env_var(env, "OMP_NUM_THREADS", nthreads);
+    std::cerr << "Info: OMP_NUM_THREADS is set to: " << nthreads << "\n";
 
     // Set the OMP_SCHEDULE environmental variable, this enforces static thread scheduling
-    if ( !set_env_var("OMP_SCHEDULE", "STATIC") ) {
-      std::cerr << "..Setting the OMP_SCHEDULE environmental variable failed" << std::endl;
-      return false;
-    }
+    set_env_var(env, "OMP_SCHEDULE", "STATIC");
 
     // Set the DR_HOOK environmental variable, this controls the tracing facility in OpenIFS, off=0 and on=1
-    if ( !set_env_var("DR_HOOK", "1") ) {
-      std::cerr << "..Setting the DR_HOOK environmental variable failed" << std::endl;
-      return false;
-    }
+    set_env_var(env, "DR_HOOK", "1");
 
     // Set the DR_HOOK_HEAPCHECK environmental variable, this ensures the heap size statistics are reported
-    if ( !set_env_var("DR_HOOK_HEAPCHECK", "no") ) {
-      std::cerr << "..Setting the DR_HOOK_HEAPCHECK environmental variable failed" << std::endl;
-      return false;
-    }
+    set_env_var(env, "DR_HOOK_HEAPCHECK", "no");
 
     // Set the DR_HOOK_STACKCHECK environmental variable, this ensures the stack size statistics are reported
-    if ( !set_env_var("DR_HOOK_STACKCHECK", "no") ) {
-      std::cerr << "..Setting the DR_HOOK_STACKCHECK environmental variable failed" << std::endl;
-      return false;
-    }
+    set_env_var(env, "DR_HOOK_STACKCHECK", "no");
 
     // Set the EC_MEMINFO environment variable, only applies to OpenIFS 43r3.
     // Disable EC_MEMINFO to remove the useless EC_MEMINFO messages to the stdout file to reduce filesize.
-    if ( !set_env_var("EC_MEMINFO", "0") ) {
-       std::cerr << "..Setting the EC_MEMINFO environment variable failed" << std::endl;
-       return false;
-    }
+    set_env_var(env, "EC_MEMINFO", "0");
 
     // Disable Heap memory stats at end of run; does not work for CPDN version of OpenIFS
-    if ( !set_env_var("EC_PROFILE_HEAP", "0") ) {
-       std::cerr << "..Setting the EC_PROFILE_HEAP environment variable failed" << std::endl;
-       return false;
-    }
+    set_env_var(env, "EC_PROFILE_HEAP", "0");
 
     // Disable all memory stats at end of run; does not work for CPDN version of OpenIFS
-    if ( !set_env_var("EC_PROFILE_MEM", "0") ) {
-       std::cerr << "..Setting the EC_PROFILE_MEM environment variable failed" << std::endl;
-       return false;
-    }
+    set_env_var(env, "EC_PROFILE_MEM", "0");
 
-    // Set the OMP_STACKSIZE environmental variable, OpenIFS needs more stack memory per process
-    if ( !set_env_var("OMP_STACKSIZE", "128M") ) {
-      std::cerr << "..Setting the OMP_STACKSIZE environmental variable failed" << std::endl;
-      return false;
-    }
+    // Set the OMP_STACKSIZE environmental variable, OpenIFS needs more stack memory per process, more at higher resolutions
+    set_env_var(env, "OMP_STACKSIZE", stacksize);
+    std::cerr << "Info: OMP_STACKSIZE is set to: " << stacksize << "\n";
 
     // Set the GRIB_SAMPLES_PATH environmental variable
     std::string GRIB_SAMPLES_var = slot_path + "/eccodes/ifs_samples/grib1_mlgrib2";
-    if ( !set_env_var("GRIB_SAMPLES_PATH", GRIB_SAMPLES_var) )  {
-      std::cerr << "..Setting the GRIB_SAMPLES_PATH failed" << std::endl;
-      return false;
-    }
-    std::cerr << "The GRIB_SAMPLES_PATH environmental variable is: " << getenv("GRIB_SAMPLES_PATH") << "\n";
+    set_env_var(env, "GRIB_SAMPLES_PATH", GRIB_SAMPLES_var);
+    std::cerr << "The GRIB_SAMPLES_PATH environmental variable is: " << GRIB_SAMPLES_var << "\n";
 
     // Set the GRIB_DEFINITION_PATH environmental variable
     std::string GRIB_DEF_var = slot_path + "/eccodes/definitions";
-    if ( !set_env_var("GRIB_DEFINITION_PATH", GRIB_DEF_var) )  {
-      std::cerr << "..Setting the GRIB_DEFINITION_PATH failed" << std::endl;
-      return false;
-    }
-    std::cerr << "The GRIB_DEFINITION_PATH environmental variable is: " << getenv("GRIB_DEFINITION_PATH") << "\n";
-
-    return true;
+    set_env_var(env, "GRIB_DEFINITION_PATH", GRIB_DEF_var);
+    std::cerr << "The GRIB_DEFINITION_PATH environmental variable is: " << GRIB_DEF_var << "\n";
 }
 
 
@@ -140,8 +110,10 @@ int main(int argc, char** argv)
     std::string app_name = argv[7];   // CPDN app name
     std::string nthreads = argv[8];   // number of OPENMP threads.
     std::string app_config_nthreads;  // blank initially.
+    int requested_nthreads = -1;      // app_config value if given, else the workunit value.
 
     // Check for optional '--nthreads <value>' at end of arg list, optionally set by app_config.xml on user's machine.
+    // The number of threads actually used is decided once the model resolution is known, see choose_nthreads().
     if ( std::string(argv[argc - 2]) == "--nthreads" ) {
       app_config_nthreads = argv[argc-1];
 
@@ -150,30 +122,27 @@ int main(int argc, char** argv)
       }
       else {
          try {
-            int max_nthreads = 8;      // GC. This is the best maximum as T319 parallel efficiency markedly drops after this many threads.
-            int min_nthreads = 2;
-            int i_nthreads = -1;
-
-            i_nthreads = std::stoi(app_config_nthreads);
-            if ( i_nthreads > max_nthreads ) {
-               std::cerr << "Warning. --nthreads value is too high. Setting to max number of threads : " << max_nthreads << '\n';
-               i_nthreads = max_nthreads;
-            }
-            else if ( i_nthreads < min_nthreads ) {
+            requested_nthreads = std::stoi(app_config_nthreads);
+            if ( requested_nthreads < 2 ) {
                std::cerr << "Warning. --nthreads is too low for this configuration. Minimum #threads is 2. Resetting.\n";
-               i_nthreads = min_nthreads;
-            }
-            else {
-               //*****************************************************
-               // Uncomment this line to enable the --nthreads argument
-               //nthreads = i_nthreads
+               requested_nthreads = 2;
             }
+            std::cerr << "Info: --nthreads " << requested_nthreads << " set by app_config\n";
          }
          catch (...) {
             std::cerr << "Warning. --nthreads argument must be a valid integer! Ignoring.\n";
          }
       }
     }
+    if ( requested_nthreads < 1 ) {
+      try {
+         requested_nthreads = std::stoi(nthreads);
+      }
+      catch (...) {
+         std::cerr << ".. Warning. nthreads argument is not a valid integer: " << nthreads << '\n';
+         requested_nthreads = 2;
+      }
+    }
 
     std::cerr << "\nControl Code version: " << CODE_VERSION << '\n' // CODE_VERSION is a macro set at compile time
               << "wu_name: " << wu_name << '\n'
@@ -225,7 +194,43 @@ int main(int argc, char** argv)
                 << "(argv9) app_version: " << argv[9] << '\n'; 
     }
 
-    boinc_begin_critical_section();
+    // Control code tunables (CPDN_* variables) can be overridden per host for testing.
+    process_env_overrides(project_path + "/oifs_override_env_vars", "CPDN_");
+
+    // Maximum time to wait for the model process to exit once it's been told to stop,
+    // for outstanding uploads at the end of the task and any residual delay before finishing.
+    const int child_exit_wait = get_env_int("CPDN_CHILD_EXIT_WAIT", 60);
+    const int upload_wait     = get_env_int("CPDN_UPLOAD_WAIT", 0);
+    const int finish_delay    = get_env_int("CPDN_FINISH_DELAY", 0);
+    const int upload_queue    = get_env_int("CPDN_UPLOAD_QUEUE", 2);     // max upload files waiting to be compressed
+    const int memory_wait     = get_env_int("CPDN_MEMORY_WAIT", 3600);   // max secs to wait for memory before starting the model
+    const cache_hints hints   = cache_hints::from_env();
+    const int disk_high       = get_env_int("CPDN_DISK_HIGH", 90);       // % of the task's disk bound to package output early
+    const bool low_disk       = get_env_int("CPDN_LOW_DISK_STAGING", 1) != 0;   // free the input zip copies while unzipping
+    const bool trace          = get_env_int("CPDN_TRACE", 1) != 0;       // timings summary in stderr, timeline in the final upload file
+    const int sample_interval = get_env_int("CPDN_SAMPLE_INTERVAL", 30); // secs between samples of the model's resource use
+
+    // The timings summary is printed however the task ends; boinc_finish() exits.
+    trace_set_enabled(trace);
+    if (trace) {
+       std::atexit([] { trace_summary(std::cerr); });
+    }
+
+    // The time in each critical section goes in the trace summary (category 'critical').
+    std::uint64_t critical_start_us = 0;
+    bool in_critical = false;
+    auto begin_critical = [&]() {
+       boinc_begin_critical_section();
+       critical_start_us = trace_now_us();
+       in_critical = true;
+    };
+    auto end_critical = [&](const char* name) {
+       if (in_critical) trace_complete(name, "critical", critical_start_us, trace_now_us() - critical_start_us);
+       in_critical = false;
+       boinc_end_critical_section();
+    };
+
+    begin_critical();
 
     // Create temporary folder for moving the results to and uploading the results from
     // BOINC measures the disk usage on the slots directory so we must move all results out of this folder
@@ -406,6 +411,13 @@ int main(int argc, char** argv)
     // this should match CUSTOP in fort.4. If it doesn't we have a problem.
     double total_nsteps = (num_days * 86400.0) / (double) timestep;     //GC. why is this a double? it's always an int.
 
+    // Model steps at which ICM output files are complete and can be moved out of the slot.
+    // NFRPOS might be in units of hrs, this is converted to model steps.
+    std::vector<int> output_steps = oifs_output_steps(ICM_file_interval, timestep, (int) total_nsteps);
+    if ( output_steps.size() > 1 ) {
+       std::cerr << " NFRPOS: model output frequency (in steps) " << output_steps[1] - output_steps[0] << '\n';
+    }
+
     //GC. Oct/25. Trickles are now fixed at every 10% of the model run with a final trickle at the end of the run.
     //    Value read from fort.4 namelist is ignored and should be removed.
 
@@ -423,12 +435,6 @@ int main(int argc, char** argv)
     // Process the ic_ancil_file:
     std::string ic_ancil_zip = slot_path + "/" + ic_ancil_file + ".zip";
 
-	// Copy the ic_ancil_zip to the slot directory and unzip
-    if ( copy_and_unzip(ic_ancil_zip, ic_ancil_zip, slot_path, "ic_ancil_zip") ) {
-       std::cerr << "..Copying and unzipping the ic_ancil_zip failed: " << ic_ancil_zip << std::endl;
-       return 1;        // should terminate, the model won't run.
-	}
-
     // Process the ifsdata_file:
     // Make the ifsdata directory and set the required paths
     std::string ifsdata_folder = slot_path + "/ifsdata";
@@ -442,14 +448,8 @@ int main(int argc, char** argv)
           return 1;        // should terminate, the model won't run.
        }
     }
-    
-    // Copy the ifsdata_zip to the slot directory and unzip
     // GC TODO. convert to fs::path and get rid of handling '/'
     std::string ifsdata_check = ifsdata_folder + "/";
-    if ( copy_and_unzip(ifsdata_zip, ifsdata_destination, ifsdata_check, "ifsdata_zip") ) {
-       std::cerr << "..Copying and unzipping the ifsdata_zip failed: " << ifsdata_zip << std::endl;
-       return 1;        // should terminate, the model won't run.
-    }
 
     // Process the climate_data_file:
     // Make the climate data directory and set the required paths
@@ -465,34 +465,22 @@ int main(int argc, char** argv)
        }
     }               
        
-    // Copy the climate_data_zip to the slot directory and unzip
-    if ( copy_and_unzip(climate_data_zip, climate_data_destination, climate_data_path, "climate_data_zip") ) {
-       std::cerr << "..Copying and unzipping the climate_data_zip failed: " << climate_data_zip << std::endl;
+    // Performance figures of the task, sent with the trickles.
+    task_perf perf;
+
+    // Copy the ic_ancil_zip to the slot directory, the ifsdata_zip and climate_data_zip to their own
+    // directories, and unzip them all at the same time.
+    std::vector<unzip_job> input_files = {
+       { ic_ancil_zip,     ic_ancil_zip,             slot_path,         "ic_ancil_zip" },
+       { ifsdata_zip,      ifsdata_destination,      ifsdata_check,     "ifsdata_zip" },
+       { climate_data_zip, climate_data_destination, climate_data_path, "climate_data_zip" },
+    };
+    if ( copy_and_unzip_concurrent(input_files, hints.write_behind, low_disk, &perf.staged_bytes) ) {
        return 1;        // should terminate, the model won't run.
     }
 
     //-------------------------------------------------------------------------------------------------------
 
-    // Set the core dump size to 0
-    struct rlimit core_limits;
-    core_limits.rlim_cur = core_limits.rlim_max = 0;
-    if (setrlimit(RLIMIT_CORE, &core_limits) != 0) {
-       std::cerr << "..Setting the core dump size to 0 failed" << std::endl;
-       return 1;
-    }
-
-    // Set the stack limit to be unlimited
-    struct rlimit stack_limits;
-    // In macOS we cannot set the stack size limit to infinity
-    #ifndef __APPLE__ // Linux
-       stack_limits.rlim_cur = stack_limits.rlim_max = RLIM_INFINITY;
-       if (setrlimit(RLIMIT_STACK, &stack_limits) != 0) {
-          std::cerr << "..Setting the stack limit to unlimited failed" << std::endl;
-          return 1;
-       }
-    #endif
-
-
     // Define the name and location of the progress file and the rcf file
     std::string progress_file = slot_path + "/progress_file_" + wuid;
     std::string rcf_file = slot_path + "/rcf";
@@ -502,7 +490,8 @@ int main(int argc, char** argv)
     int model_completed = 0;  // Indicates model state; 0=not completed, 1=completed
     int last_upload;          // The time of the last upload file (in seconds)
     int upload_file_number = 0;
-    int last_cpu_time = 0;
+    double last_cpu_time = 0;     // cpu time used by the model in previous runs of this task (secs)
+    progress_estimate estimate;   // model step rate & fraction done from previous runs
 
     // Check whether the rcf file and the progress file (contains model progress) are not already present from an unscheduled shutdown
     std::cerr << "Checking for rcf file and progress file: " << progress_file << '\n';
@@ -524,7 +513,12 @@ int main(int argc, char** argv)
        return 1;
     }
     else if ( file_exists(progress_file) && !file_exists(rcf_file) ) {
-       read_progress_file(progress_file, last_cpu_time, upload_file_number, last_iter, last_upload, model_completed);
+       if ( !read_progress_file(progress_file, last_cpu_time, upload_file_number, last_iter, last_upload, model_completed, &estimate) ) {
+          print_last_lines("NODE.001_01", 70);
+          print_last_lines("ifs.stat",8);
+          std::cerr << "..progress file exists, but cannot be read => problem with model, quitting run" << '\n';
+          return 1;
+       }
        // If last_iter less than the restart interval, then model is at beginning and rcf has yet to be produced then continue
        if (std::stoi(last_iter) >= restart_interval) {
           // Otherwise if progress file exists and rcf file does not exist, an error has occurred, then kill model run
@@ -575,7 +569,12 @@ int main(int argc, char** argv)
        }
        rcf_file_stream.close();
 
-       read_progress_file(progress_file, last_cpu_time, upload_file_number, last_iter, last_upload, model_completed);
+       if ( !read_progress_file(progress_file, last_cpu_time, upload_file_number, last_iter, last_upload, model_completed, &estimate) ) {
+          print_last_lines("NODE.001_01", 70);
+          print_last_lines("ifs.stat",8);
+          std::cerr << "..progress file exists, but cannot be read => problem with model, quitting run" << '\n';
+          return 1;
+       }
 
        // Check if the CSTEP variable from rcf is greater than the last_iter, if so then quit model run
        if ( stoi(cstep_value) > stoi(last_iter) ) {
@@ -594,10 +593,11 @@ int main(int argc, char** argv)
     }
 
     // Update progress file with current values
-    double current_cpu_time = 0;
+    double current_cpu_time = last_cpu_time;
     double fraction_done = 0;
+    ProgressEstimator progress((int) total_nsteps, estimate);
 
-    update_progress_file(progress_file, current_cpu_time, upload_file_number, last_iter, last_upload, model_completed);
+    update_progress_file(progress_file, current_cpu_time, upload_file_number, last_iter, last_upload, model_completed, progress.estimate());
 
     // seconds between upload files: upload_interval
     // seconds between ICM files: ICM_file_interval * timestep
@@ -638,6 +638,18 @@ int main(int argc, char** argv)
        }
     }
 
+    // Move any model output left in the slot by a previous run before the model restarts.
+    // After this, output files are only moved at the NFRPOS output steps.
+    retval = move_result_files(slot_path, temp_path, exptid);
+    if (retval < 0) {
+       std::cerr << "..Moving result files from a previous run to the temp folder in the projects directory failed" << std::endl;
+       return 1;
+    }
+    else if (retval > 0) {
+       std::cerr << "Moved " << retval << " result files from a previous run to the temp folder\n";
+    }
+    auto next_output = std::lower_bound(output_steps.begin(), output_steps.end(), std::stoi(last_iter));
+
     // Determine which OpenIFS executable to run.
     // GC. This should be an input parameter on the command line.
 
@@ -674,11 +686,195 @@ int main(int argc, char** argv)
     // Start the OpenIFS job
     int process_status=1;
 
+    // The model's environment, arguments and limits are all set up here, not in the child process.
+    launch_spec model;
+    model.exe = exe_cmd;
+    model.env = current_environment("CPDN_");       // the control code's tunables are not for the model
+
+    // Number of threads from the request, the cores free of other bound OpenIFS tasks and how well
+    // the model scales at this resolution.
+    host_topology topology;
+    std::set<int> busy_cpus;
+    int free_cores = 0;
+    if (read_topology(topology)) {
+       busy_cpus  = cpus_bound_by_others("oifs_");
+       free_cores = topology.physical_cores(busy_cpus);
+       std::cerr << "Host topology: " << topology.cpus.size() << " cpus, " << topology.physical_cores()
+                 << " physical cores available, " << free_cores << " free\n";
+    }
+    int i_nthreads = choose_nthreads(requested_nthreads, free_cores, horiz_resolution);
+
+    // Don't start the model until there's memory for it, allowing for other CPDN tasks that are starting up.
+    // Use fewer threads if that makes it fit, otherwise wait with backoff, checking for a suspend, quit or abort
+    // from the client (this code handles those itself). After memory_wait secs, not counting time suspended,
+    // start anyway and leave it to the OS.
+    {
+       ScopedTimer timer("memory admission", "startup");
+       auto deadline = chrono::steady_clock::now() + chrono::seconds(memory_wait);
+       auto interval = chrono::seconds(30);
+       while (true) {
+          std::uint64_t available = available_memory();
+          std::uint64_t others    = other_tasks_memory(project_path);
+          available = available > others ? available - others : 0;
+
+          int fit = threads_that_fit(horiz_resolution, i_nthreads, std::min(i_nthreads, 2), available);
+          if (fit > 0) {
+             if (fit < i_nthreads) {
+                std::cerr << "Thread count: reduced to " << fit << " threads to fit in the memory available\n";
+                i_nthreads = fit;
+             }
+             break;
+          }
+
+          std::cerr << "Memory available: " << (available >> 20) << " MiB (after " << (others >> 20)
+                    << " MiB for other tasks), model needs " << (model_footprint(horiz_resolution, i_nthreads) >> 20) << " MiB\n";
+          if (chrono::steady_clock::now() + interval > deadline) {
+             std::cerr << "..Warning. Starting the model without enough memory available\n";
+             break;
+          }
+          std::cerr << "Waiting " << interval.count() << " secs for memory before starting the model\n";
+          end_critical("startup");
+          auto wait_end = chrono::steady_clock::now() + interval;
+          bool suspended = false;
+          while (suspended || chrono::steady_clock::now() < wait_end) {
+             auto tick = chrono::steady_clock::now();
+             std::this_thread::sleep_for(chrono::seconds(1));
+             BOINC_STATUS status;
+             boinc_get_status(&status);
+             if (status.quit_request || status.abort_request || status.no_heartbeat) {
+                // The model hasn't started, so there's nothing to save; the client restarts the task later on a quit.
+                std::cerr << "Quit or abort request received from the BOINC client while waiting for memory, exiting\n";
+                return status.abort_request ? 1 : 0;
+             }
+
+             // Time suspended doesn't count towards the wait, and the model isn't started until the task is resumed.
+             if (status.suspended != suspended) {
+                suspended = status.suspended;
+                std::cerr << (suspended ? "Suspended" : "Resumed") << " by the BOINC client while waiting for memory\n";
+             }
+             if (suspended) {
+                auto paused = chrono::steady_clock::now() - tick;
+                deadline += paused;
+                wait_end += paused;
+             }
+          }
+          begin_critical();
+          interval = std::min(interval * 2, chrono::seconds(600));
+       }
+    }
+    nthreads = std::to_string(i_nthreads);
+
+    // Start reading the model's input files into the page cache so they're there when the model opens them.
+    // Only use half the memory that will be left once the model is running.
+    if (hints.prefetch) {
+       std::uint64_t available = available_memory();
+       std::uint64_t needed    = model_footprint(horiz_resolution, i_nthreads);
+       std::vector<fs::path> inputs = { ifsdata_folder, climate_data_path };
+       std::error_code ec;
+       for (const auto& entry : fs::directory_iterator(slot_path, ec)) {
+          std::string name = entry.path().filename().string();
+          if (name.rfind("ICM", 0) == 0 && name.find("INI") != std::string::npos) inputs.push_back(entry.path());
+       }
+       std::uint64_t bytes = prefetch_files(inputs, available > needed ? (available - needed) / 2 : 0);
+       std::cerr << "Prefetching " << (bytes >> 20) << " MiB of model input files\n";
+    }
+
+    oifs_setenvs(model.env, slot_path, nthreads, std::to_string(omp_stacksize_mb(horiz_resolution)) + "M");
+
+    // Bind the model threads one per physical core, in a single NUMA node where possible,
+    // avoiding cores other OpenIFS tasks are bound to. Can be turned off with CPDN_CPU_BIND=0.
+    std::string places;
+    if (get_env_int("CPDN_CPU_BIND", 1) != 0) {
+       if (!topology.cpus.empty()) {
+          model.cpus = plan_placement(topology, std::stoi(nthreads), busy_cpus);
+       }
+       if (!model.cpus.empty()) {
+          places = omp_places(model.cpus);
+          set_env_var(model.env, "OMP_PLACES", places);
+          set_env_var(model.env, "OMP_PROC_BIND", "close");
+          std::cerr << "Binding model threads to cpus: " << places << '\n';
+       }
+       else {
+          std::cerr << "Not enough free physical cores to bind model threads, leaving placement to the OS\n";
+       }
+    }
+
+    // Custom environment variable overrides, if the override file exists.
+    // NOTE! This should only be used for testing and never advertised to users.
+    process_env_overrides(project_path + "/oifs_override_env_vars", model.env, "", "CPDN_");
+
+    // If the placement was overridden, don't restrict the model to the cpus chosen here.
+    if (!model.cpus.empty() && (get_env_var(model.env, "OMP_PLACES") != places || get_env_var(model.env, "OMP_PROC_BIND") != "close")) {
+       std::cerr << "OMP_PLACES or OMP_PROC_BIND overridden, model cpu affinity not set\n";
+       model.cpus.clear();
+    }
+
+    // OpenIFS 40r1 requires the -e exptid argument, later versions do not.
+    // GC. TODO. This should be an input arg, not decided here.
+    if ( (app_name == "openifs") || (app_name == "oifs_40r1") ) {
+       model.args = {"-e", exptid};
+    }
+
+    // No core dumps, and an unlimited stack (where the hard limit allows; not possible on macOS).
+    model.rlimits.emplace_back(RLIMIT_CORE, 0);
+    #ifndef __APPLE__
+       model.rlimits.emplace_back(RLIMIT_STACK, RLIM_INFINITY);
+    #endif
+
     std::cerr << "Launching OpenIFS executable: " << exe_cmd << std::endl;
-    long model_process = launch_process_oifs(project_path, slot_path, exe_cmd, nthreads, exptid, app_name);
-    if (model_process > 0) process_status = 0;     //GC TODO. Need to handle when model_process =-1, i.e. launch failed (see code in launch_process_oifs)
+    child_process model_child = launch_model(model);
+    long model_process = model_child.pid;
+    if (model_process > 0) process_status = 0;
+
+    end_critical("startup");
+
+    // Model cpu time, including previous runs.
+    ModelCpuTime model_cpu(model_process, last_cpu_time);
 
-    boinc_end_critical_section();
+    // Memory, I/O, page faults & context switches of the model, for diagnosing failed or slow tasks.
+    ResourceSampler resources(model_process, sample_interval);
+
+    // Time per model step from ifs.stat, to spot the model slowing down.
+    std::string ifs_stat = slot_path + "/ifs.stat";     // GC. TODO: should be std::filesystem path.
+    ThroughputMonitor throughput;
+
+    // Update the performance figures for a trickle at 'step'. The timings are for this run of the task,
+    // less the time suspended.
+    const auto run_start      = chrono::steady_clock::now();
+    const int  run_start_step = std::stoi(last_iter);
+    std::uint64_t zip_input = 0, zip_output = 0;
+    long zip_msecs = 0;
+    auto update_perf = [&](int step) {
+       double wall  = chrono::duration<double>(chrono::steady_clock::now() - run_start).count() - perf.suspended_secs;
+       double cpu   = current_cpu_time - last_cpu_time;
+       int    steps = step - run_start_step;
+       if (steps > 0) {
+          perf.wall_per_step = wall / steps;
+          perf.cpu_per_step  = cpu / steps;
+       }
+       if (wall > 0) perf.cpu_efficiency = cpu / (wall * i_nthreads);
+       if (zip_msecs > 0) perf.zip_mb_per_sec = (zip_input / 1.0e6) / (zip_msecs / 1000.0);
+       if (zip_output > 0) perf.zip_ratio = (double) zip_input / zip_output;
+       perf.peak_rss = std::max(perf.peak_rss, peak_rss(model_process));
+       perf.slowdowns = throughput.slowdowns();
+    };
+    auto count_upload_file = [&](std::uint64_t input_bytes, const std::string& zip_file, long msecs) {
+       std::error_code ec;
+       std::uint64_t size = fs::file_size(zip_file, ec);
+       zip_input  += input_bytes;
+       zip_output += size;
+       zip_msecs  += msecs;
+       perf.uploaded_bytes += size;
+    };
+    auto files_size = [](const std::vector<fs::path>& files) {
+       std::uint64_t total = 0;
+       for (const auto& file : files) {
+          std::error_code ec;
+          std::uint64_t size = fs::file_size(file, ec);
+          if (!ec) total += size;
+       }
+       return total;
+    };
 
 
     // process_status = 0 running
@@ -694,9 +890,75 @@ int main(int argc, char** argv)
     // Periodically check the process status and the BOINC client status
     std::string stat_lastline;
     std::string second_part;
-    std::string ifs_stat = slot_path + "/ifs.stat";     // GC. TODO: should be std::filesystem path.
 
     std::vector<fs::path> zfl;
+    std::vector<upload_status> uploads;        // uploads in progress
+
+    // Upload files are compressed by a background worker so the model and the BOINC client are
+    // still monitored. last_upload & upload_file_number are only updated once an upload file is
+    // complete; queued_upload & next_upload_number include the upload files still in the queue.
+    UploadWorker upload_worker(upload_queue, hints);
+    int queued_upload = last_upload;
+    int next_upload_number = upload_file_number;
+
+    // Disk used by the slot & temp folder against the client's disk bound for the task (CPDN_DISK_BOUND, in MiB,
+    // overrides it for testing). When it's nearly full, the output so far is packaged without waiting for the end
+    // of the upload interval, see below.
+    APP_INIT_DATA init_data;
+    boinc_get_init_data(init_data);
+    std::uint64_t disk_bound = (std::uint64_t) init_data.rsc_disk_bound;
+    if (get_env_int("CPDN_DISK_BOUND", 0) > 0) {
+       disk_bound = (std::uint64_t) get_env_int("CPDN_DISK_BOUND", 0) << 20;
+    }
+    DiskFootprint disk(disk_bound, disk_high / 100.0);
+    disk.scan_slot(slot_path);
+    disk.scan_temp(temp_path);
+    std::cerr << "Disk usage of slot & temp folder: " << (disk.usage() >> 20) << " MiB, bound: " << (disk_bound >> 20) << " MiB\n";
+
+    // Commit the upload files the worker has completed: start the upload, save the new upload state,
+    // then delete the files now in the zip. Only this is done in a critical section.
+    // Returns non-zero if an upload file could not be created.
+    auto commit_uploads = [&]() -> int {
+       for (auto& result : upload_worker.completed()) {
+          if (!result.ok) {
+             std::cerr << ".. compressing upload file failed: " << result.job.zip_file << std::endl;
+             return 1;
+          }
+
+          begin_critical();
+
+          if (!result.job.logical_name.empty() && !result.job.files.empty()) {
+             std::cerr << "Uploading the intermediate file: " << result.job.logical_name << '\n';
+             if (start_upload(result.job.logical_name, uploads)) {
+                end_critical("upload commit");
+                return 1;
+             }
+          }
+          last_upload = result.job.last_upload;
+          upload_file_number = result.job.number + 1;
+          update_progress_file(progress_file, current_cpu_time, upload_file_number, last_iter, last_upload, model_completed, progress.estimate());
+
+          // Files have been successfully zipped, they can now be deleted
+          std::uint64_t input_bytes = 0;
+          for (const auto& fpath : result.job.files) {
+             std::error_code ec;
+             std::uint64_t size = fs::file_size(fpath, ec);
+             if (!ec) input_bytes += size;
+             if (fs::remove(fpath, ec)) {
+                disk.removed_from_temp(size);
+             }
+             else if (ec) {
+                std::cerr << "Error deleting file: " << fpath << ", error: " << ec.message() << '\n';
+             }
+          }
+          if (!result.job.files.empty()) {
+             count_upload_file(input_bytes, result.job.zip_file, result.msecs);
+          }
+
+          end_critical("upload commit");
+       }
+       return 0;
+    };
 
     int count = 0;
     int current_iter = 0;
@@ -729,23 +991,39 @@ int main(int argc, char** argv)
                        iter = last_iter;                             // revert to last valid step
                     }
                  }
+                 throughput.poll(ifs_stat);
              }
           }
 
           if (std::stoi(iter) != std::stoi(last_iter)) {
-             // Construct file name of the ICM result file
-             second_part = get_second_part(last_iter, exptid);
+             // If the step went backwards (model restarted) its output will be rewritten, move it again.
+             if (std::stoi(iter) < std::stoi(last_iter)) {
+                next_output = std::lower_bound(output_steps.begin(), output_steps.end(), std::stoi(iter));
+             }
 
              // Move the ICMGG, ICMSH & ICMUA result files to the task folder in the project directory
-             // GC. Why do this every timestep? This should be done at same frequency as NFRPOS.
-             std::vector<std::string> icm = {"ICMGG", "ICMSH", "ICMUA"};
-             for (const auto& part : icm) {
-                  retval = move_result_file(slot_path, temp_path, part, second_part);
-                  if (retval) {
-                     std::cerr << "..Copying " << part << " result file to the temp folder in the projects directory failed" << "\n";
-                     return retval;
-                  }
+             // for every output step completed since the last check; the step in ifs.stat is the one in progress.
+             while (next_output != output_steps.end() && *next_output < std::stoi(iter)) {
+                ScopedTimer timer("output step", "move");
+                second_part = get_second_part(std::to_string(*next_output), exptid);
+
+                std::vector<std::string> icm = {"ICMGG", "ICMSH", "ICMUA"};
+                for (const auto& part : icm) {
+                     bool in_slot = file_exists(slot_path + "/" + part + second_part);
+                     retval = move_result_file(slot_path, temp_path, part, second_part);
+                     if (retval) {
+                        std::cerr << "..Moving " << part << " result file to the temp folder in the projects directory failed" << "\n";
+                        return retval;
+                     }
+                     std::error_code ec;
+                     std::uint64_t size = fs::file_size(temp_path + "/" + part + second_part, ec);
+                     if (in_slot && !ec) disk.moved_to_temp(size);
+                }
+                ++next_output;
              }
+             disk.scan_slot(slot_path);
+             trace_counter("model step", std::stoi(iter));
+             trace_counter("disk usage MiB", disk.usage() >> 20);
 
              // Convert iteration number to seconds
              current_iter = (std::stoi(last_iter)) * timestep;
@@ -755,21 +1033,28 @@ int main(int argc, char** argv)
              //std::cerr << "current_iter: " << current_iter << '\n';
              //std::cerr << "last_upload: " << last_upload << '\n';
 
-             // Upload a new upload file if the end of an upload_interval has been reached
-             if((( current_iter - last_upload ) >= (upload_interval * timestep)) && (current_iter < total_length_of_simulation)) {
-                // Create an intermediate results zip file
-                zfl.clear();
-
-                std::cerr << "End of upload interval reached, starting a new upload process" << std::endl;
-
-                // *****  Critical section -- all returns must now call boinc_end_critical_section()  *****
-                boinc_begin_critical_section();
+             // Queue a new upload file if the end of an upload_interval has been reached, or early if the disk is nearly full.
+             // It's compressed in the background by the upload worker and committed by commit_uploads().
+             // Upload files are due at every upload interval from the start of the run. One queued early takes the place
+             // of the next one due, whose output goes in the one after, so the number of upload files doesn't change.
+             // That's why there's no early upload file in the last interval before the final upload file.
+             int interval_secs = upload_interval * timestep;
+             int uploads_due   = (interval_secs > 0) ? current_iter / interval_secs : next_upload_number + 1;
+             bool interval_end = uploads_due > next_upload_number;
+             bool disk_full    = !interval_end && uploads_due == next_upload_number && current_iter > queued_upload &&
+                                 (uploads_due + 1) * interval_secs < total_length_of_simulation && disk.near_bound();
+
+             if( (interval_end || disk_full) && (current_iter < total_length_of_simulation)) {
+                upload_job job;
+                job.number      = next_upload_number;
+                job.last_upload = current_iter;
+
+                if (interval_end) {
+                   std::cerr << "End of upload interval reached, queueing upload file: " << job.number << std::endl;
+                }
 
                 // Cycle through all the steps from the last upload to the current upload
-                for (auto i = (last_upload / timestep); i < (current_iter / timestep); i++) {   //  current_iter/timestep is just last_iter!
-                   //std::cerr << "last_upload/timestep: " << (last_upload/timestep) << '\n';
-                   //std::cerr << "current_iter/timestep: " << (current_iter/timestep) << '\n';
-                   //std::cerr << "i: " << (std::to_string(i)) << '\n';
+                for (auto i = (queued_upload / timestep); i < (current_iter / timestep); i++) {   //  current_iter/timestep is just last_iter!
 
                    // Construct file name of the ICM result file
                    second_part = get_second_part(std::to_string(i), exptid);
@@ -781,110 +1066,50 @@ int main(int argc, char** argv)
                                 fpath /= part + second_part;
                       if (file_exists(fpath.string())) {
                          std::cerr << "Adding to the zip: " << fpath << '\n';
-                         zfl.push_back(fpath);
+                         job.files.push_back(fpath);
                       }
                    }
                 }
 
-                // If running under a BOINC client
+                // If running under a BOINC client the upload file is the logical name, not the physical name
                 if (!standalone) {
-
-                   if (zfl.size() > 0)
-                   {
-                      // Create the zipped upload file from the list of files added to zfl
-                      std::string upload_file = project_path + result_base_name + "_" + std::to_string(upload_file_number) + ".zip";
-
-                      std::cerr << "Compressing upload file: " << upload_file << '\n';
-
-                      // Time the compression for diagnostics
-                      auto start = chrono::high_resolution_clock::now();
-                      auto outcome = cpdn_zip(upload_file, zfl);
-                      auto stop = chrono::high_resolution_clock::now();
-                      auto duration = chrono::duration_cast<chrono::milliseconds>(stop - start);
-                      std::cerr << "Time taken to compress upload file: " << duration.count() << " ms\n";
-
-                      retval = outcome ? 0 : 1;
-
-                      if (retval) {
-                         std::cerr << ".. compressing upload file failed" << std::endl;
-                         boinc_end_critical_section();
-                         return retval;
-                      }
-                      else {
-                         // Files have been successfully zipped, they can now be deleted
-                         for (auto j = 0; j < (int) zfl.size(); ++j) {
-                            // Delete the zipped file
-                            try {
-                                fs::remove(zfl[j]);
-                            } catch (const fs::filesystem_error& e) {
-                                std::cerr << "Error deleting file: " << zfl[j] << ", error: " << e.what() << '\n';
-                            }
-                         }
-                      }
-
-                      // Upload the file. In BOINC the upload file is the logical name, not the physical name
-                      std::string upload_file_name = "upload_file_" + std::to_string(upload_file_number) + ".zip";
-                      std::cerr << "Uploading the intermediate file: " << upload_file_name << '\n';
-                      std::this_thread::sleep_until(chrono::system_clock::now() + chrono::seconds(20));
-                      retval = boinc_upload_file(upload_file_name);
-                      if (retval) {
-                         std::cerr << "..boinc_upload_file failed for file: " << upload_file_name << std::endl;
-                         boinc_end_critical_section();
-                         return retval;
-                      }
-                      retval = boinc_upload_status(upload_file_name);
-                      if (!retval) {
-                         std::cerr << "Finished the upload of the intermediate file: " << upload_file_name << '\n';
-                      }
-                   }
-                   last_upload = current_iter; 
+                   job.zip_file     = project_path + result_base_name + "_" + std::to_string(job.number) + ".zip";
+                   job.logical_name = "upload_file_" + std::to_string(job.number) + ".zip";
                 }
-
                 // Else running in standalone
                 else {
-                   std::string upload_file_name = app_name + "_" + unique_member_id + "_" + start_date + "_" + \
-                                                  std::to_string((int)num_days) + "_" + batchid + "_" + wuid + "_" + \
-                                                  std::to_string(upload_file_number) + ".zip";
-                   std::cerr << "The current upload_file_name is: " << upload_file_name << '\n';
-
-                   // Create the zipped upload file from the list of files added to zfl
-                   std::string upload_file = project_path + upload_file_name;
-
-                   if (zfl.size() > 0){
-                      if (!cpdn_zip(upload_file, zfl)) {
-                         retval = 1;
-                      }
+                   job.zip_file = project_path + app_name + "_" + unique_member_id + "_" + start_date + "_" + \
+                                  std::to_string((int)num_days) + "_" + batchid + "_" + wuid + "_" + \
+                                  std::to_string(job.number) + ".zip";
+                   std::cerr << "The current upload_file_name is: " << fs::path(job.zip_file).filename() << '\n';
+                }
 
-                      if (retval) {
-                         std::cerr << "..Creating the zipped upload file failed" << std::endl;
-                         boinc_end_critical_section();
-                         return retval;
-                      }
-                      else {
-                         // Files have been successfully zipped, they can now be deleted
-                         for (auto j = 0; j < (int) zfl.size(); ++j) {
-                            // Delete the zipped file
-                            try {
-                                fs::remove(zfl[j]);
-                            } catch (const fs::filesystem_error& e) {
-                                std::cerr << "Error deleting file: " << zfl[j] << ", error: " << e.what() << '\n';
-                            }
-                         }
-                      }
+                // Only package early if there's some output to package.
+                // If the queue is full the same files plus any new ones are tried again at the next step.
+                if (interval_end || !job.files.empty()) {
+                   if (!interval_end) {
+                      std::cerr << "Disk nearly full, queueing upload file early: " << job.number << '\n';
+                   }
+                   trace_instant(interval_end ? "upload file queued" : "upload file queued early", "upload");
+                   if (upload_worker.submit(std::move(job))) {
+                      queued_upload = current_iter;
+                      next_upload_number++;
+                   }
+                   else {
+                      std::cerr << "Upload queue is full, upload file will be queued later" << '\n';
                    }
-                   last_upload = current_iter;
-
                 }
-
-                // *****  Normal end of critical section  *****
-                boinc_end_critical_section();
-                upload_file_number++;
              }                            // end of upload new output file block.
 
              // Trickle every required fraction of the model run
              if ( (std::stoi(iter) % trickle_freq) == 0 ) {
                std::cerr << "Sending progress trickle message to CPDN for step: " << iter << '\n';
-               process_trickle(current_cpu_time, wu_name, result_base_name, slot_path, current_iter, standalone );
+               update_perf(current_iter / timestep);
+               perf.remaining_secs = progress.time_remaining();
+               if (perf.remaining_secs >= 0) {
+                  std::cerr << "Estimated time remaining of the model run: " << std::lround(perf.remaining_secs / 60) << " minutes\n";
+               }
+               process_trickle(current_cpu_time, wu_name, result_base_name, slot_path, current_iter, standalone, &perf);
                last_trickle_iter = current_iter;
              }
           }                               // end of if it's a new timestep block.
@@ -892,16 +1117,16 @@ int main(int argc, char** argv)
           count = 0;
 
           // Update progress file with current values
-          update_progress_file(progress_file, current_cpu_time, upload_file_number, last_iter, last_upload, model_completed);
+          update_progress_file(progress_file, current_cpu_time, upload_file_number, last_iter, last_upload, model_completed, progress.estimate());
        }
 
-       // Calculate current_cpu_time, only update if cpu_time returns a value
-       if (cpu_time(model_process)) {
-          current_cpu_time = last_cpu_time + cpu_time(model_process);
-       }
+       // Calculate current_cpu_time, once per loop
+       current_cpu_time = model_cpu.sample();
+       resources.sample();
 
       // Calculate the fraction done
-      fraction_done = model_frac_done( std::stof(iter), total_nsteps, std::stoi(nthreads) );
+      progress.update( std::stoi(iter), current_cpu_time );
+      fraction_done = progress.fraction_done();
 
       if (!standalone) {
          // If the current iteration is at a restart iteration
@@ -916,17 +1141,32 @@ int main(int argc, char** argv)
          // Provide the fraction done to the BOINC client, necessary for the percentage bar on the client
          boinc_fraction_done(fraction_done);
     
-         process_status = check_boinc_status(model_process,process_status);
+         process_status = check_boinc_status(model_process, process_status, &perf.suspended_secs, &upload_worker);
+
+         // Log any intermediate uploads the client has finished
+         poll_upload_status(uploads);
       }
    
+      // Start the upload of any upload files the worker has completed
+      if (commit_uploads()) {
+         return 1;
+      }
+
       process_status = check_child_status(model_process,process_status);
     }
 
     //----- End of main loop ---------------------------------------------------------------------------	
 
 
-    // Time delay to ensure model files are all flushed to disk
-    std::this_thread::sleep_until(chrono::system_clock::now() + chrono::seconds(60));
+    // Make sure the model has exited (it may have been killed above) so all its output files are complete.
+    wait_for_child(model_process, child_exit_wait, model_child.pidfd);
+    if (model_child.pidfd >= 0) close(model_child.pidfd);
+
+    // Its peak memory, now it's been reaped.
+    struct rusage usage;
+    if (getrusage(RUSAGE_CHILDREN, &usage) == 0) {
+       perf.peak_rss = std::max(perf.peak_rss, (std::uint64_t) usage.ru_maxrss * 1024);
+    }
 
     // Print content of key model files to help with diagnosing problems
     print_last_lines("NODE.001_01", 70);    //  main model output log	
@@ -945,7 +1185,7 @@ int main(int argc, char** argv)
          print_last_lines("ifs.stat",8);
          print_last_lines("rcf",11);              // openifs restart control
          print_last_lines("waminfo",17);          // wave model restart control
-         print_last_lines(progress_file,8);
+         print_progress_file(progress_file);
          std::cerr << "..Failed, model did not complete successfully" << std::endl;
          return 1;
        }
@@ -959,20 +1199,19 @@ int main(int argc, char** argv)
     // Update model_completed
     model_completed = 1;
 
-    // Handle the last ICM files
-    second_part = get_second_part(last_iter, exptid);
+    // Finish the upload files still queued, the final upload file must be the last one.
+    upload_worker.drain();
+    if (commit_uploads()) {
+       return 1;
+    }
 
-    // Move the ICMGG, ICMSH and ICMUA model output files to the task folder in the project directory
-    std::vector<std::string> icm = {"ICMGG", "ICMSH", "ICMUA"};
-    for (const auto& part : icm) {
-       retval = move_result_file(slot_path, temp_path, part, second_part);    // GC. TODO: combine part with second_part and pass as single argument
-       if (retval) {
-          std::cerr << "..Copying " << part << " result file to the temp folder in the projects directory failed" << "\n";
-          return retval;
-       }
+    // Move the remaining ICMGG, ICMSH and ICMUA model output files to the task folder in the project directory
+    if (move_result_files(slot_path, temp_path, exptid) < 0) {
+       std::cerr << "..Moving the final result files to the temp folder in the projects directory failed" << "\n";
+       return 1;
     }
 
-    boinc_begin_critical_section();
+    begin_critical();
 
     //-----------------------------Create the final results zip file-----------------------------------------
 
@@ -984,6 +1223,35 @@ int main(int argc, char** argv)
     std::cerr << "Adding to the zip: " << node_file << '\n';
     std::cerr << "Adding to the zip: " << ifsstat_file << '\n';
 
+    // The model's resource use over the run.
+    std::string resources_file = slot_path + "/resources.txt";
+    if (resources.samples() > 0) {
+       resources.summary(std::cerr);
+       if (resources.write(resources_file)) {
+          zfl.push_back(resources_file);
+          std::cerr << "Adding to the zip: " << resources_file << '\n';
+       }
+    }
+
+    // The model's throughput over the run.
+    throughput.poll(ifs_stat);
+    throughput.summary(std::cerr);
+    std::string throughput_file = slot_path + "/throughput.txt";
+    std::ofstream throughput_out(throughput_file);
+    throughput.summary(throughput_out);
+    throughput_out.close();
+    if (throughput_out) {
+       zfl.push_back(throughput_file);
+       std::cerr << "Adding to the zip: " << throughput_file << '\n';
+    }
+
+    // Timeline of the control code up to here, e.g. to see where the time goes over many tasks.
+    std::string trace_file = slot_path + "/control_trace.json";
+    if (trace && trace_write_chrome(trace_file)) {
+       zfl.push_back(trace_file);
+       std::cerr << "Adding to the zip: " << trace_file << '\n';
+    }
+
     // Read the remaining list of files from the slots directory and add the matching files to the list of files for the zip
     // GC. TODO. Update to C++ 17.
     DIR *dirp = opendir(temp_path.c_str());
@@ -1015,17 +1283,25 @@ int main(int argc, char** argv)
           std::cerr << "Compressing final upload file: " << upload_file << '\n';
 
           // Time the compression for diagnostics
-          auto start = chrono::high_resolution_clock::now();
-          auto outcome = cpdn_zip(upload_file, zfl);
-          auto stop = chrono::high_resolution_clock::now();
-          auto duration = chrono::duration_cast<chrono::milliseconds>(stop - start);
-          std::cerr << "Time taken to compress final upload file: " << duration.count() << " ms\n";
+          std::atomic<bool> cancel(false);
+          cpdn_zip_control control = boinc_zip_control("final upload file", cancel);
+          control.write_behind = hints.write_behind;
+          std::uint64_t input_bytes = files_size(zfl);
+          bool outcome;
+          long msecs;
+          {
+             ScopedTimer timer("final upload file", "compress");
+             outcome = cpdn_zip(upload_file, zfl, &control);
+             msecs = timer.elapsed_ms();
+             std::cerr << "Time taken to compress final upload file: " << msecs << " ms\n";
+          }
+          if (outcome) count_upload_file(input_bytes, upload_file, msecs);
           
           retval = outcome ? 0 : 1;
 
           if (retval) {
              std::cerr << "..compressing final upload file failed" << std::endl;
-             boinc_end_critical_section();
+             end_critical("final");
              return retval;
           }
           else {
@@ -1040,27 +1316,25 @@ int main(int argc, char** argv)
              }
           }
 
-          // Upload the file. In BOINC the upload file is the logical name, not the physical name
+          // Upload the file once it's on disk. In BOINC the upload file is the logical name, not the physical name
           std::string upload_file_name = "upload_file_" + std::to_string(upload_file_number) + ".zip";
           std::cerr << "Uploading the final file: " << upload_file_name << '\n';
-          std::this_thread::sleep_until(chrono::system_clock::now() + chrono::seconds(20));
-          retval = boinc_upload_file(upload_file_name);
+          fsync_file(upload_file);
+          if (hints.drop) drop_cached(upload_file);
+          retval = start_upload(upload_file_name, uploads);
           if (retval) {
-             std::cerr << "..boinc_upload_file failed for file: " << upload_file_name << std::endl;
-             boinc_end_critical_section();
+             end_critical("final");
              return retval;
           }
-          retval = boinc_upload_status(upload_file_name);
-          if (!retval) {
-             std::cerr << "Finished the upload of the final file" << '\n';
-          }
+          wait_upload_status(uploads, upload_wait);
 
 	       // Produce final trickle it's the same timestep as the last main loop trickle
           if ( current_iter > last_trickle_iter ) {
-            process_trickle(current_cpu_time,wu_name,result_base_name,slot_path,current_iter,standalone);
+            update_perf(current_iter / timestep);
+            process_trickle(current_cpu_time,wu_name,result_base_name,slot_path,current_iter,standalone,&perf);
           }
        }
-       boinc_end_critical_section();
+       end_critical("final");
     }
 
     // Else running in standalone
@@ -1074,12 +1348,17 @@ int main(int argc, char** argv)
        std::string upload_file = project_path + upload_file_name;
 
        if (zfl.size() > 0) {
-          if (!cpdn_zip(upload_file, zfl)) {
+          std::uint64_t input_bytes = files_size(zfl);
+          ScopedTimer timer("final upload file", "compress");
+          if (!cpdn_zip(upload_file, zfl) || !fsync_file(upload_file)) {
              retval = 1;
           }
+          else {
+             count_upload_file(input_bytes, upload_file, timer.elapsed_ms());
+          }
           if (retval) {
              std::cerr << "..Creating the compressed upload file failed" << std::endl;
-             boinc_end_critical_section();
+             end_critical("final");
              return retval;
           }
           else {
@@ -1094,7 +1373,8 @@ int main(int argc, char** argv)
              }
          }
          // Produce final trickle
-         process_trickle(current_cpu_time,wu_name,result_base_name,slot_path,current_iter,standalone);
+         update_perf(current_iter / timestep);
+         process_trickle(current_cpu_time,wu_name,result_base_name,slot_path,current_iter,standalone,&perf);
        }
     }
 
@@ -1103,10 +1383,13 @@ int main(int argc, char** argv)
     // Now that the task has finished, remove the temp folder
     fs::remove_all(temp_path);
 
-    boinc_end_critical_section();
+    end_critical("final");
 
-    // Delay to ensure all files are flushed to disk before exiting
-    std::this_thread::sleep_until(chrono::system_clock::now() + chrono::seconds(120));
+    // All files written have been flushed to disk above, any extra delay is only for testing.
+    if (finish_delay > 0) {
+       std::cerr << "Waiting " << finish_delay << " secs before finishing\n";
+       std::this_thread::sleep_for(chrono::seconds(finish_delay));
+    }
     std::cerr << "Task finished." << std::endl;
 
     // if finished normally
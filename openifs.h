@@ -3,5 +3,6 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
-bool oifs_setenvs(const std::string&, const std::string&);
\ No newline at end of file
+void oifs_setenvs(std::vector<std::string>&, const std::string&, const std::string&, const std::string&);
\ No newline at end of file
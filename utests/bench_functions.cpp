@@ -0,0 +1,221 @@
+//
+// Microbenchmark of the control code's parsing and utility functions, those called on every poll of the
+// model or at startup, for the climateprediction.net project (CPDN)
+//
+// Glenn Carver, CPDN, 2025->
+//
+// Each function is called on inputs like those of a real run (ifs.stat lines, fort.4 and rcf lines, the
+// 'jf_' file references) for at least --secs. Results are written as JSON so runs on different commits can
+// be compared, with a table on stderr:
+//    ns_per_call      wall time per call
+//    allocs_per_call  C++ allocations (operator new) per call
+//    bytes_per_call   bytes allocated per call
+//
+// Usage:  bench_functions [--secs 0.5] [--dir path] [--label text] [--json file]
+//
+//   --secs    minimum time to run each function for (default 0.5)
+//   --dir     scratch directory for the files read and written (default: system temp directory)
+//   --label   free text stored in the results, e.g. the git commit
+//   --json    file for the results (default: stdout)
+
+#include "../CPDN_control_code.h"
+#include "../zip/bench_util.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using bench_clock = std::chrono::steady_clock;
+
+namespace {
+
+    struct result {
+        std::string   name;
+        std::uint64_t calls = 0;
+        double        ns_per_call = 0, allocs_per_call = 0, bytes_per_call = 0;
+    };
+
+    // Keeps the results of the calls so they aren't optimised away
+    volatile std::size_t sink = 0;
+
+    // Calls in batches, for the functions that need nothing set up between calls.
+    template <typename Call>
+    result measure(const std::string& name, double secs, Call call) {
+        const int batch = 100;
+        call();                                   // warm up, e.g. the first call's static state
+        result res{name};
+        std::chrono::duration<double> elapsed(0);
+        std::uint64_t allocs = 0, bytes = 0;
+        while (elapsed.count() < secs) {
+            auto a0 = bench_allocations.load(), b0 = bench_allocated_bytes.load();
+            auto start = bench_clock::now();
+            for (int i = 0; i < batch; i++) call();
+            elapsed += bench_clock::now() - start;
+            allocs += bench_allocations.load() - a0;
+            bytes  += bench_allocated_bytes.load() - b0;
+            res.calls += batch;
+        }
+        res.ns_per_call     = elapsed.count() * 1e9 / res.calls;
+        res.allocs_per_call = double(allocs) / res.calls;
+        res.bytes_per_call  = double(bytes) / res.calls;
+        return res;
+    }
+
+    // Times each call on its own, leaving out what's set up before it.
+    template <typename Setup, typename Call>
+    result measure_each(const std::string& name, double secs, Setup setup, Call call) {
+        setup();
+        call();
+        result res{name};
+        std::chrono::duration<double> elapsed(0);
+        std::uint64_t allocs = 0, bytes = 0;
+        while (elapsed.count() < secs) {
+            setup();
+            auto a0 = bench_allocations.load(), b0 = bench_allocated_bytes.load();
+            auto start = bench_clock::now();
+            call();
+            elapsed += bench_clock::now() - start;
+            allocs += bench_allocations.load() - a0;
+            bytes  += bench_allocated_bytes.load() - b0;
+            res.calls++;
+        }
+        res.ns_per_call     = elapsed.count() * 1e9 / res.calls;
+        res.allocs_per_call = double(allocs) / res.calls;
+        res.bytes_per_call  = double(bytes) / res.calls;
+        return res;
+    }
+
+    // An ifs.stat line for a step, as the model writes it
+    std::string stat_line(int step) {
+        std::ostringstream line;
+        line << " 11:34:34 0AAA00AAA STEPO" << std::setw(8) << step
+             << "     0.356    0.356    0.361   0:02   0:02 0.18085634484813E-15 0GB   0MB";
+        return line.str();
+    }
+}
+
+
+int main(int argc, char** argv) {
+    double secs = 0.5;
+    fs::path dir = fs::temp_directory_path();
+
+    bench_args args;
+    args.values = {
+        { "--secs", [&](const std::string& v) { secs = std::atof(v.c_str()); } },
+        { "--dir",  [&](const std::string& v) { dir  = v; } },
+    };
+    int exit_code = parse_bench_args(argc, argv, "bench_functions",
+                                     "Usage: bench_functions [--secs 0.5] [--dir path] [--label text] [--json file]\n", args);
+    if (exit_code >= 0) return exit_code;
+
+    fs::path bench_dir = dir / ("bench_functions_" + std::to_string(getpid()));
+    fs::create_directories(bench_dir);
+    std::vector<result> results;
+
+    // ifs.stat is polled every few seconds; the line for the step is the 4th column.
+    const std::string stepo = stat_line(1008);
+    std::string column;
+    results.push_back(measure("oifs_parse_stat", secs, [&]() {
+        oifs_parse_stat(stepo, column, 4);
+        sink += column.size();
+    }));
+
+    // A seasonal run's ifs.stat, polled when nothing has been added and when one step has
+    const std::string ifs_stat = (bench_dir / "ifs.stat").string();
+    {
+        std::ofstream out(ifs_stat);
+        for (int step = 0; step < 2000; step++) out << stat_line(step) << '\n';
+    }
+    std::string lastline;
+    results.push_back(measure("fread_last_line (no new line)", secs, [&]() {
+        sink += fread_last_line(ifs_stat, lastline);
+    }));
+    std::ofstream ifs_stat_out(ifs_stat, std::ios::app);
+    int next_step = 2000;
+    results.push_back(measure_each("fread_last_line (new line)", secs,
+        [&]() { ifs_stat_out << stat_line(next_step++) << std::endl; },
+        [&]() { sink += fread_last_line(ifs_stat, lastline); }));
+    ifs_stat_out.close();
+
+    // The fort.4 lines are searched for each key at startup, most lines don't have it.
+    const std::string namelist_hit = "!IFSDATA_FILE=ifsdata_0", namelist_miss = " NFRPOS=-6,";
+    std::string value;
+    results.push_back(measure("extract_key_value (key)", secs, [&]() {
+        sink += extract_key_value(namelist_hit, "IFSDATA_FILE", '=', value);
+    }));
+    results.push_back(measure("extract_key_value (no key)", secs, [&]() {
+        sink += extract_key_value(namelist_miss, "IFSDATA_FILE", '=', value);
+    }));
+
+    // The step in the rcf file
+    const std::string rcf_line = " CSTEP=\"    1008\",";
+    results.push_back(measure("read_delimited_line", secs, [&]() {
+        value.clear();
+        sink += read_delimited_line(rcf_line, "\"", "CSTEP", 2, value);
+    }));
+
+    // The 'jf_' file reference in a project file
+    const std::string reference = (bench_dir / "oifs_43r3_NNNN_yyyymmddhh_1_d000_0.zip").string();
+    {
+        std::ofstream out(reference);
+        out << ">jf_ic_ancil_0<\n";
+    }
+    results.push_back(measure("get_tag", secs, [&]() {
+        sink += get_tag(reference).size();
+    }));
+
+    // The output file names at each output step
+    const std::string last_iter = "1008", exptid = "EXPT";
+    results.push_back(measure("get_second_part", secs, [&]() {
+        sink += get_second_part(last_iter, exptid).size();
+    }));
+
+    // A line of the environment overrides file
+    const std::string export_line = "export OMP_NUM_THREADS='6'";
+    std::string name;
+    results.push_back(measure("parse_export", secs, [&]() {
+        sink += parse_export(export_line, name, value);
+    }));
+
+    // The progress file is updated every poll but only written when something has changed.
+    const std::string progress_file = (bench_dir / "progress_file.xml").string();
+    update_progress_file(progress_file, 100.0, 1, "1008", 0, 0);
+    results.push_back(measure("update_progress_file (unchanged)", secs, [&]() {
+        update_progress_file(progress_file, 100.0, 1, "1008", 0, 0);
+    }));
+    int iter = 1008;
+    results.push_back(measure_each("update_progress_file (new step)", secs,
+        [&]() { iter++; },
+        [&]() { update_progress_file(progress_file, 100.0, 1, std::to_string(iter), 0, 0); }));
+
+    fs::remove_all(bench_dir);
+
+    std::ostringstream json;
+    json << "{\n  \"benchmark\": \"bench_functions\",\n  \"label\": " << json_string(args.label) << ",\n  \"results\": [";
+    std::cerr << std::left << std::setw(36) << "function" << std::right << std::setw(12) << "ns/call"
+              << std::setw(14) << "allocs/call" << std::setw(14) << "bytes/call" << '\n';
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const auto& res = results[i];
+        std::cerr << std::left << std::setw(36) << res.name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << res.ns_per_call << std::setprecision(2) << std::setw(14) << res.allocs_per_call
+                  << std::setprecision(1) << std::setw(14) << res.bytes_per_call << '\n';
+        json << (i ? "," : "") << "\n    {\"function\": " << json_string(res.name) << ", \"calls\": " << res.calls
+             << std::fixed << std::setprecision(1) << ", \"ns_per_call\": " << res.ns_per_call
+             << std::setprecision(2) << ", \"allocs_per_call\": " << res.allocs_per_call
+             << std::setprecision(1) << ", \"bytes_per_call\": " << res.bytes_per_call << "}";
+    }
+    json << "\n  ]\n}\n";
+
+    if (!write_bench_json("bench_functions", args.json, json.str())) return 1;
+    return 0;
+}
@@ -0,0 +1,62 @@
+// Test to check the disk space tracking of a task
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+#include "../CPDN_disk.h"
+
+
+ /**
+  * @brief  Test: DiskFootprint
+  */
+
+int t_disk_footprint()
+{
+    TEST("t_disk_footprint");
+    namespace fs = std::filesystem;
+
+    // A slot with staged input data in a subdirectory and model output at the top, and an empty temp folder.
+    fs::path root = fs::temp_directory_path() / "t_disk_footprint";
+    fs::remove_all(root);
+    fs::create_directories(root / "slot/ifsdata");
+    fs::create_directories(root / "temp");
+    std::ofstream(root / "slot/ifsdata/C11CLIM") << std::string(4000, 'c');
+    std::ofstream(root / "slot/ICMGGtest+000024") << std::string(1000, 'g');
+
+    DiskFootprint disk(10000, 0.8);
+    disk.scan_slot(root / "slot");
+    disk.scan_temp(root / "temp");
+    std::cout << "initial usage: " << disk.usage() << "\n";
+    if ( disk.usage() != 5000 || disk.near_bound() ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // The model writes more output; moving it to the temp folder doesn't change the total.
+    std::ofstream(root / "slot/ICMSHtest+000024") << std::string(3000, 's');
+    disk.scan_slot(root / "slot");
+    fs::rename(root / "slot/ICMSHtest+000024", root / "temp/ICMSHtest+000024");
+    disk.moved_to_temp(3000);
+    std::cout << "after output: " << disk.usage() << "\n";
+    if ( disk.usage() != 8000 || !disk.near_bound() ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Packaged and deleted.
+    fs::remove(root / "temp/ICMSHtest+000024");
+    disk.removed_from_temp(3000);
+    disk.scan_slot(root / "slot");
+    if ( disk.usage() != 5000 || disk.near_bound() ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // No bound, never nearly full.
+    DiskFootprint unbounded(0, 0.8);
+    unbounded.scan_slot(root / "slot");
+    if ( unbounded.near_bound() ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    fs::remove_all(root);
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+// Test to check reading the last lines of a file
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+
+
+ /**
+  * @brief  Test: read_last_lines, for files smaller and larger than the blocks read
+  */
+
+int t_last_lines()
+{
+    TEST("t_last_lines");
+    namespace fs = std::filesystem;
+
+    fs::path file = fs::temp_directory_path() / "t_last_lines.txt";
+    auto write = [&](const std::string& content) {
+        std::ofstream out(file, std::ios::trunc);
+        out << content;
+    };
+    std::string lines;
+
+    // Small file with and without the final newline
+    write("one\ntwo\nthree\n");
+    if ( read_last_lines(file.string(), 2, lines) != 2 || lines != "two\nthree" ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    write("one\ntwo\nthree");
+    if ( read_last_lines(file.string(), 5, lines) != 3 || lines != "one\ntwo\nthree" ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Lines spanning the blocks read backwards
+    std::string content;
+    for (int i = 0; i < 20000; i++) content += "line " + std::to_string(i) + '\n';
+    write(content);
+    if ( read_last_lines(file.string(), 3, lines) != 3 || lines != "line 19997\nline 19998\nline 19999" ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    if ( read_last_lines(file.string(), 30000, lines) != 20000 || lines + '\n' != content ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Empty and missing files
+    write("");
+    if ( read_last_lines(file.string(), 8, lines) != 0 || print_last_lines(file.string(), 8) != 0 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    fs::remove(file);
+    if ( read_last_lines(file.string(), 8, lines) != 0 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
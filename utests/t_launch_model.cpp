@@ -0,0 +1,76 @@
+// Test to check launching a model process
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+
+
+ /**
+  * @brief  Test: launch_model
+  */
+
+int t_launch_model()
+{
+    TEST("t_launch_model");
+
+    struct rlimit parent_core;
+    getrlimit(RLIMIT_CORE, &parent_core);
+
+    // Environment, arguments, limits and output file are all set by the parent.
+    launch_spec spec;
+    spec.exe  = "/bin/sh";
+    spec.args = {"-c", "echo $CPDN_LAUNCH_TEST; ulimit -c; exit 3"};
+    spec.env  = current_environment();
+    set_env_var(spec.env, "CPDN_LAUNCH_TEST", "first");
+    set_env_var(spec.env, "CPDN_LAUNCH_TEST", "model");
+    spec.rlimits.emplace_back(RLIMIT_CORE, 0);
+    spec.stdout_file = "launch_model_test.out";
+    fs::remove(spec.stdout_file);
+
+    child_process child = launch_model(spec);
+    if ( child.pid <= 0 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    bool exited = wait_for_child(child.pid, 10, child.pidfd);
+    if (child.pidfd >= 0) close(child.pidfd);
+
+    std::string env_line, core_line;
+    std::ifstream out(spec.stdout_file);
+    std::getline(out, env_line);
+    std::getline(out, core_line);
+    std::cout << "launch_model : pid = " << child.pid << ", pidfd = " << child.pidfd
+              << ", output = '" << env_line << "', '" << core_line << "'\n";
+
+    struct rlimit after_core;
+    getrlimit(RLIMIT_CORE, &after_core);
+    if ( !exited || env_line != "model" || core_line != "0" || getenv("CPDN_LAUNCH_TEST") != NULL ||
+         after_core.rlim_cur != parent_core.rlim_cur ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    fs::remove(spec.stdout_file);
+
+    // The control code's own tunables are kept out of the model's environment, from this process and the override file.
+    setenv("CPDN_LAUNCH_TUNABLE", "1", 1);
+    {
+        std::ofstream overrides("launch_model_test_overrides");
+        overrides << "export CPDN_UPLOAD_WAIT=5\nexport OMP_STACKSIZE='2G'\n";
+    }
+    std::vector<std::string> model_env = current_environment("CPDN_");
+    process_env_overrides("launch_model_test_overrides", model_env, "", "CPDN_");
+    unsetenv("CPDN_LAUNCH_TUNABLE");
+    fs::remove("launch_model_test_overrides");
+    if ( !get_env_var(model_env, "CPDN_LAUNCH_TUNABLE").empty() || !get_env_var(model_env, "CPDN_UPLOAD_WAIT").empty() ||
+         get_env_var(model_env, "OMP_STACKSIZE") != "2G" ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // An executable that doesn't exist must be reported by the launch.
+    spec.exe = "./no_such_model.exe";
+    if ( launch_model(spec).pid != -1 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+// Test to check the memory admission of the model
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+#include "../CPDN_memory.h"
+
+
+ /**
+  * @brief  Test: available_memory, model_footprint & threads_that_fit
+  */
+
+int t_memory()
+{
+    TEST("t_memory");
+    namespace fs = std::filesystem;
+    const std::uint64_t MiB = 1024 * 1024;
+
+    // Stack size scales up from 128M with resolution
+    if ( omp_stacksize_mb("159") != 128 || omp_stacksize_mb("TL319") != 128 || omp_stacksize_mb("511") != 256 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    if ( model_footprint("255", 4) <= model_footprint("159", 4) || model_footprint("255", 4) <= model_footprint("255", 2) ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // A fake /proc and cgroup v2 tree: 8 GiB available on the host, the task's cgroup has 2 GiB left
+    // and its parent 1 GiB.
+    fs::path root = fs::temp_directory_path() / "t_memory";
+    fs::remove_all(root);
+    fs::create_directories(root / "proc/self");
+    fs::create_directories(root / "cgroup/user.slice/boinc.service");
+    std::ofstream(root / "proc/meminfo") << "MemTotal:       16000000 kB\nMemFree:  100 kB\nMemAvailable:    8388608 kB\n";
+    std::ofstream(root / "proc/self/cgroup") << "0::/user.slice/boinc.service\n";
+    std::ofstream(root / "cgroup/user.slice/boinc.service/memory.max") << "max\n";
+    std::ofstream(root / "cgroup/memory.max") << "max\n";
+
+    std::uint64_t available = available_memory((root / "proc").string(), (root / "cgroup").string());
+    std::cout << "no cgroup limit: " << available / MiB << " MiB\n";
+    if ( available != 8192 * MiB ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    std::ofstream(root / "cgroup/user.slice/boinc.service/memory.max") << 4096 * MiB << "\n";
+    std::ofstream(root / "cgroup/user.slice/boinc.service/memory.current") << 2048 * MiB << "\n";
+    std::ofstream(root / "cgroup/user.slice/memory.max") << 1024 * MiB << "\n";
+    available = available_memory((root / "proc").string(), (root / "cgroup").string());
+    std::cout << "cgroup limited: " << available / MiB << " MiB\n";
+    if ( available != 1024 * MiB ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    fs::remove_all(root);
+
+    // Fewer threads if that fits, none if even the minimum doesn't
+    std::uint64_t two = model_footprint("255", 2);
+    if ( threads_that_fit("255", 4, 2, 64 * 1024 * MiB) != 4 || threads_that_fit("255", 4, 2, two) != 2 ||
+         threads_that_fit("255", 4, 2, two - 1) != 0 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Nothing else from a non-existent project is running
+    if ( other_tasks_memory((fs::temp_directory_path() / "t_memory_no_project").string()) != 0 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+// Test to check moving a result file
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+
+
+ /**
+  * @brief  Test: move_file
+  */
+
+int t_move_file()
+{
+    TEST("t_move_file");
+
+    // Generate a test result file in the working directory
+    std::string source = "ICMGGtest+000024";
+    std::string destination = "ICMGGtest+000024.moved";
+    std::string content = "GRIB test content 7777";
+    std::ofstream source_out(source, std::ios::out | std::ios::trunc );
+    source_out << content;
+    source_out.close();
+
+    // Same directory, so the file must be renamed not copied
+    MoveMethod method = move_file(source, destination);
+    std::cout << "move_file : method = " << move_method_name(method) << "\n";
+
+    std::string moved_content;
+    std::ifstream moved_in(destination);
+    std::getline(moved_in, moved_content);
+
+    if ( method != MoveMethod::Rename || file_exists(source) || moved_content != content ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Moving a file that doesn't exist must fail
+    if ( move_file(source, destination) != MoveMethod::Failed || !file_exists(destination) ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    fs::remove(destination);
+
+    // Another filesystem, so the file must be cloned or copied and then the source removed.
+    // Several MB so the copy takes more than one call.
+    fs::path other_fs = "/dev/shm";
+    struct stat shm_stat, cwd_stat;
+    if ( stat(other_fs.c_str(), &shm_stat) == 0 && stat(".", &cwd_stat) == 0 && shm_stat.st_dev != cwd_stat.st_dev ) {
+        source = (other_fs / "ICMGGtest+000024").string();
+        std::string data(5 * 1024 * 1024 + 17, '\0');
+        for (std::size_t i = 0; i < data.size(); i++) data[i] = static_cast<char>((i * 7919) % 251);
+        std::ofstream big_out(source, std::ios::binary | std::ios::trunc);
+        big_out << data;
+        big_out.close();
+
+        method = move_file(source, destination);
+        std::cout << "move_file across filesystems : method = " << move_method_name(method) << "\n";
+
+        std::ifstream big_in(destination, std::ios::binary);
+        std::string copied((std::istreambuf_iterator<char>(big_in)), std::istreambuf_iterator<char>());
+        fs::remove(destination);
+        if ( (method != MoveMethod::Reflink && method != MoveMethod::CopyRange) || file_exists(source) || copied != data ) {
+            fs::remove(source);
+            FAIL; return EXIT_FAILURE;
+        }
+    }
+    else {
+        std::cout << "move_file across filesystems : not tested, " << other_fs << " is not another filesystem\n";
+    }
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
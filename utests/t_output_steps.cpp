@@ -0,0 +1,53 @@
+// Test to check the model output steps and catching up on output left in the slot
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+
+
+ /**
+  * @brief  Test: oifs_output_steps and move_result_files
+  */
+
+int t_output_steps()
+{
+    TEST("t_output_steps");
+
+    // NFRPOS in steps, in hours (negative) and unset
+    if ( oifs_output_steps(6, 3600, 24) != std::vector<int>{0, 6, 12, 18, 24} ||
+         oifs_output_steps(-6, 1800, 24) != std::vector<int>{0, 12, 24} ||
+         oifs_output_steps(0, 3600, 3) != std::vector<int>{0, 1, 2, 3} ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // A restart: output from the interrupted run is still in the slot, with files that must be left alone.
+    fs::path slot = fs::temp_directory_path() / "t_output_steps_slot";
+    fs::path temp = fs::temp_directory_path() / "t_output_steps_temp";
+    fs::remove_all(slot);
+    fs::remove_all(temp);
+    fs::create_directories(slot);
+    fs::create_directories(temp);
+    for (const auto& name : {"ICMGGEXPT+000006", "ICMSHEXPT+000006", "ICMUAEXPT+000006", "ICMGGEXPT+000012",
+                             "ICMGGEXPX+000006", "ICMGGEXPT", "ifs.stat"}) {
+        std::ofstream out(slot / name);
+        out << name;
+    }
+
+    int nmoved = move_result_files(slot.string(), temp.string(), "EXPT");
+    std::cout << "move_result_files : moved " << nmoved << " files\n";
+    bool caught_up = nmoved == 4 && fs::exists(temp / "ICMUAEXPT+000006") && fs::exists(temp / "ICMGGEXPT+000012") &&
+                     !fs::exists(slot / "ICMGGEXPT+000006") && fs::exists(slot / "ICMGGEXPX+000006") &&
+                     fs::exists(slot / "ICMGGEXPT") && fs::exists(slot / "ifs.stat");
+
+    // Nothing left to catch up on
+    if ( !caught_up || move_result_files(slot.string(), temp.string(), "EXPT") != 0 ) {
+        fs::remove_all(slot);
+        fs::remove_all(temp);
+        FAIL; return EXIT_FAILURE;
+    }
+
+    fs::remove_all(slot);
+    fs::remove_all(temp);
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+// Test to check parsing the cpu time from /proc/<pid>/stat
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+#include "../CPDN_proc_stats.h"
+
+
+ /**
+  * @brief  Test: parse_proc_stat_cpu
+  */
+
+int t_proc_stat()
+{
+    TEST("t_proc_stat");
+
+    // Process names can contain spaces and brackets. utime=1200, stime=34, cutime=5, cstime=1
+    std::string stat = "4242 (oifs model) x) S 4241 4242 4241 0 -1 4194304 93718 0 0 0 1200 34 5 1 20 0 8 0 "
+                       "123456 1234567890 9876 18446744073709551615 1 1 0 0 0 0 0 4096 0 0 0 0 17 3 0 0 0 0 0\n";
+    unsigned long long ticks = 0;
+
+    if ( !parse_proc_stat_cpu(stat, ticks) || ticks != 1240 ) {
+        FAIL;
+        std::cout << "ticks = " << ticks << "\n";
+        return EXIT_FAILURE;
+    }
+
+    // Truncated line must be rejected
+    if ( parse_proc_stat_cpu("4242 (oifs) S 4241 4242", ticks) ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Our own process can be sampled
+    ModelCpuTime own_cpu(getpid(), 10.5);
+    if ( own_cpu.sample() < 10.5 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Page faults: minflt=93718, majflt=0
+    std::uint64_t minor = 0, major = 1;
+    if ( !parse_proc_stat_faults(stat, minor, major) || minor != 93718 || major != 0 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Fields from status, only matching whole keys at the start of a line
+    std::uint64_t value = 0;
+    std::string status = "Name:\toifs\nVmHWM:\t  812 kB\nVmRSS:\t  800 kB\nvoluntary_ctxt_switches:\t12\nnonvoluntary_ctxt_switches:\t3\n";
+    if ( !parse_proc_field(status, "VmRSS", value) || value != 800 ||
+         !parse_proc_field(status, "voluntary_ctxt_switches", value) || value != 12 ||
+         parse_proc_field(status, "Vm", value) ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Our own process: a first sample straight away, the next only after the interval
+    ResourceSampler resources(getpid(), 60);
+    if ( !resources.sample() || resources.sample() || resources.series().size() != 1 || resources.series()[0].rss == 0 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    resources.summary(std::cout);
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
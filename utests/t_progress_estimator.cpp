@@ -0,0 +1,57 @@
+// Test to check the model progress estimate
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+
+
+ /**
+  * @brief  Test: ProgressEstimator
+  */
+
+int t_progress_estimator()
+{
+    TEST("t_progress_estimator");
+
+    auto t0 = chrono::steady_clock::now();
+    auto at = [t0](int secs) { return t0 + chrono::seconds(secs); };
+
+    // 10 step run, model starts up slowly then takes 10 secs (20 cpu secs) per step.
+    ProgressEstimator progress(10, progress_estimate());
+    progress.update(0, 0.0, at(0));
+    progress.update(1, 60.0, at(30));       // includes model start up, not used
+    progress.update(2, 80.0, at(40));
+    progress.update(3, 100.0, at(50));
+
+    progress.update(3, 110.0, at(55));      // half way through step 3
+    double frac = progress.fraction_done();
+    std::cout << "fraction_done = " << frac << ", wall_per_step = " << progress.estimate().wall_per_step
+              << ", cpu_per_step = " << progress.estimate().cpu_per_step << ", time_remaining = " << progress.time_remaining() << "\n";
+
+    if ( std::fabs(frac - 0.35) > 1e-6 || std::fabs(progress.estimate().cpu_per_step - 20.0) > 1e-6 ||
+         std::fabs(progress.time_remaining() - 65.0) > 1e-6 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // A slow step must not move past the next step, nor go backwards after a restart.
+    progress.update(3, 200.0, at(500));
+    if ( progress.fraction_done() >= 0.4 || progress.fraction_done() < frac ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    frac = progress.fraction_done();
+    progress.update(1, 210.0, at(510));
+    if ( progress.fraction_done() < frac ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Restored from the progress file, the step rate is known straight away.
+    ProgressEstimator restarted(10, progress.estimate());
+    restarted.update(5, 0.0, at(0));
+    restarted.update(5, 0.0, at(5));
+    if ( restarted.fraction_done() < frac || restarted.time_remaining() <= 0.0 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
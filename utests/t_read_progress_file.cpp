@@ -26,7 +26,7 @@ int t_read_progress_file()
 
     // Test setup
     std::string last_iter;
-    int last_cpu_time = -1;
+    double last_cpu_time = -1;
     int upload_number = -1;
     int last_upload = -1;
     int completed = -1;
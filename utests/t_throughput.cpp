@@ -0,0 +1,84 @@
+// Test to check the model throughput monitor
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+#include "../CPDN_throughput.h"
+
+
+ /**
+  * @brief  Test: parse_stat_timings and ThroughputMonitor
+  */
+
+int t_throughput()
+{
+    TEST("t_throughput");
+    namespace fs = std::filesystem;
+
+    stat_step timings;
+    if ( !parse_stat_timings(" 11:34:34 0AAA00AAA STEPO       1     0.356    0.356    0.361   0:02   0:02 0.18E-15 0GB   0MB", timings) ||
+         timings.step != 1 || timings.cpu != 0.356 || timings.wall != 0.361 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    // Setup lines and lines without the timings
+    if ( parse_stat_timings(" 11:34:32 000000000 CNT4     -999     0.115    0.115    0.137   0:00", timings) ||
+         parse_stat_timings(" 11:34:34 0AAA00AAA STEPO       1", timings) ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Steps of 1 sec with every 3rd step slower, then 2 secs with the cpu time up too, then back to 1 sec.
+    ThroughputMonitor monitor(5, 10);
+    int step = 0;
+    auto run = [&](int nsteps, double secs) {
+        for (int i = 0; i < nsteps; i++, step++) {
+            double wall = (step % 3 == 0) ? secs * 1.8 : secs;
+            monitor.add({ step, wall * 0.9, wall });
+            monitor.add({ step, wall * 0.9, wall });        // repeated line
+        }
+    };
+    run(30, 1.0);
+    if ( monitor.baseline() != 1.0 || monitor.slow() || monitor.slowdowns() != 0 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    run(10, 2.0);
+    if ( !monitor.slow() || monitor.slowdowns() != 1 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    run(10, 1.0);
+    if ( monitor.slow() || monitor.slowdowns() != 1 || monitor.steps() != 49 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    std::ostringstream summary;
+    monitor.summary(summary);
+    std::cout << summary.str();
+    if ( summary.str().find("THROUGHPUT steps=49 ") != 0 || summary.str().find(" baseline_s=1 median_s=1 ") == std::string::npos ||
+         summary.str().find(" slowdowns=1 ") == std::string::npos ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Reading ifs.stat as it's written; the last line isn't complete yet.
+    fs::path ifs_stat = fs::temp_directory_path() / "t_throughput_ifs.stat";
+    {
+        std::ofstream out(ifs_stat);
+        out << " 11:34:32 000000000 CNT3     -999     0.103    0.103    0.117   0:00   0:00 0.0E+00 0GB   0MB\n"
+            << " 11:34:34 0AAA00AAA STEPO       0     1.718    1.718    1.796   0:02   0:02 0.1E-15 0GB   0MB\n"
+            << " 11:34:34 0AAA00AAA STEPO       1     0.356    0.356    0.361   0:02   0:02 0.1E-15 0GB   0MB\n"
+            << " 11:34:35 0AAA00AAA STEPO       2     0.3";
+    }
+    ThroughputMonitor reader;
+    int first = reader.poll(ifs_stat.string());
+    {
+        std::ofstream out(ifs_stat, std::ios::app);
+        out << "50    0.350    0.355   0:03   0:03 0.1E-15 0GB   0MB\n";
+    }
+    int second = reader.poll(ifs_stat.string());
+    fs::remove(ifs_stat);
+    std::cout << "steps read: " << first << ", " << second << "\n";
+    if ( first != 1 || second != 1 || reader.steps() != 2 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+// Test to check the placement of model threads on the host cpus
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+#include "../CPDN_topology.h"
+
+
+ /**
+  * @brief  Test: plan_placement, parse_cpu_list & choose_nthreads
+  */
+
+int t_topology()
+{
+    TEST("t_topology");
+
+    if ( parse_cpu_list("0-3,8,10-11\n") != std::vector<int>({0,1,2,3,8,10,11}) || !parse_cpu_list("").empty() ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Two NUMA nodes, 4 cores each, with 2 hardware threads per core: cpus 0-7 & 16-23 on node 0,
+    // 8-15 & 24-31 on node 1. Cpu n and n+16 are the same core.
+    host_topology topo;
+    for (int cpu = 0; cpu < 32; cpu++) {
+        cpu_info info;
+        info.cpu  = cpu;
+        info.core = (cpu % 16) / 2;      // pairs of cpus share a core: 4 cores per node
+        info.node = (cpu % 16) / 8;
+        topo.cpus.push_back(info);
+    }
+    std::cout << "physical_cores = " << topo.physical_cores() << "\n";
+
+    // One thread per physical core, all on one node.
+    auto cpus = plan_placement(topo, 4);
+    std::cout << "4 threads: " << omp_places(cpus) << "\n";
+    if ( topo.physical_cores() != 8 || cpus != std::vector<int>({0,2,4,6}) ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Another task bound to node 0 pushes the model to node 1.
+    cpus = plan_placement(topo, 2, {0,1,2,3,16,17});
+    std::cout << "2 threads, node 0 partly busy: " << omp_places(cpus) << "\n";
+    if ( cpus != std::vector<int>({4,6}) ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    cpus = plan_placement(topo, 3, {0,1,2,3,16,17});
+    if ( cpus != std::vector<int>({8,10,12}) ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // More threads than a node has cores spans nodes; more than there are cores, no placement.
+    if ( plan_placement(topo, 6).size() != 6 || !plan_placement(topo, 9).empty() ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Cores with a cpu bound by another task are not free.
+    if ( topo.physical_cores({0,1,2,3,16,17}) != 6 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Thread count: capped by the resolution's scaling and the free cores, never more than requested.
+    std::cout << "max useful threads: T159 " << max_useful_threads("159") << ", T319 " << max_useful_threads("319")
+              << ", T511 " << max_useful_threads("TCo511") << "\n";
+    if ( max_useful_threads("319") != 8 || max_useful_threads("") != 8 ||
+         max_useful_threads("159") >= max_useful_threads("319") || max_useful_threads("511") <= 8 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    if ( choose_nthreads(16, 0, "319") != 8 || choose_nthreads(6, 0, "319") != 6 ||
+         choose_nthreads(8, 3, "319") != 3 || choose_nthreads(3, 1, "159") != 2 || choose_nthreads(1, 0, "159") != 1 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // The real host
+    host_topology host;
+    if ( !read_topology(host) || host.cpus.empty() || host.physical_cores() < 1 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    std::cout << "host: " << host.cpus.size() << " cpus, " << host.physical_cores() << " cores\n";
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
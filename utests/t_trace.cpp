@@ -0,0 +1,67 @@
+// Test to check the timings recorded by the control code
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+#include "../CPDN_trace.h"
+
+
+ /**
+  * @brief  Test: ScopedTimer, trace_summary and trace_write_chrome
+  */
+
+int t_trace()
+{
+    TEST("t_trace");
+    namespace fs = std::filesystem;
+
+    // Events from two threads.
+    {
+        ScopedTimer timer("ic_ancil_zip", "staging");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    std::thread other([] {
+        ScopedTimer timer("upload file", "compress");
+        trace_counter("model step", 12);
+    });
+    other.join();
+    trace_counter("model step", 24);
+    trace_instant("upload \"file\" queued", "upload");
+
+    std::ostringstream summary;
+    trace_summary(summary);
+    std::cout << summary.str();
+    if ( summary.str().find("TRACE category=staging name=\"ic_ancil_zip\" count=1 total_ms=") == std::string::npos ||
+         summary.str().find("name=\"upload \\\"file\\\" queued\"") == std::string::npos ||
+         summary.str().find("name=\"model step\" count=2 last=24 max=24") == std::string::npos ||
+         summary.str().find("category=compress name=\"upload file\" count=1") == std::string::npos ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // The timeline, with the quotes in the event name escaped.
+    fs::path trace_file = fs::temp_directory_path() / "t_trace.json";
+    if ( !trace_write_chrome(trace_file.string()) ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    std::ifstream in(trace_file);
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    fs::remove(trace_file);
+    if ( json.find("\"traceEvents\":[") == std::string::npos || json.find("\"ph\":\"X\"") == std::string::npos ||
+         json.find("\"args\":{\"value\":24}") == std::string::npos || json.find("upload \\\"file\\\" queued") == std::string::npos ||
+         json.substr(json.size() - 3) != "]}\n" ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // Nothing is recorded when disabled.
+    trace_set_enabled(false);
+    trace_counter("model step", 36);
+    trace_set_enabled(true);
+    summary.str("");
+    trace_summary(summary);
+    if ( summary.str().find("last=24") == std::string::npos ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
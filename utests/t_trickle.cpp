@@ -0,0 +1,52 @@
+// Test to check the trickle message contents
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+
+
+ /**
+  * @brief  Test: process_trickle, standalone so the trickle is written to the slot directory.
+  */
+
+int t_trickle()
+{
+    TEST("t_trickle");
+    namespace fs = std::filesystem;
+
+    fs::path slot = fs::temp_directory_path() / "t_trickle";
+    fs::remove_all(slot);
+    fs::create_directories(slot);
+
+    task_perf perf;
+    perf.wall_per_step  = 1.5;
+    perf.cpu_efficiency = 0.875;
+    perf.staged_bytes   = 123456789;
+    perf.peak_rss       = 4500000000;
+    perf.remaining_secs = 7200.4;
+    process_trickle(3600.5, "wu_1", "result_1", slot.string(), 86400, 1, &perf);
+
+    std::string trickle;
+    for (const auto& file : fs::directory_iterator(slot)) {
+        std::ifstream in(file.path());
+        trickle.assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    }
+    std::cout << trickle;
+    fs::remove_all(slot);
+
+    // The original fields come first and are unchanged.
+    const std::string original = "<wu>wu_1</wu>\n<result>result_1</result>\n<ph></ph>\n<ts>86400</ts>\n<cp>3600.5</cp>\n<vr></vr>\n";
+    if ( trickle.compare(0, original.size(), original) != 0 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    if ( trickle.find("<wall_step>1.5</wall_step>") == std::string::npos ||
+         trickle.find("<cpu_eff>0.875</cpu_eff>") == std::string::npos ||
+         trickle.find("<staged>123456789</staged>") == std::string::npos ||
+         trickle.find("<remaining>7200</remaining>") == std::string::npos ||
+         trickle.find("<peak_rss>4500000000</peak_rss></perf>\n") == std::string::npos ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+// Test to check writing the progress file
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+
+
+ /**
+  * @brief  Test: update progress file, then read it back
+  */
+
+int t_update_progress_file()
+{
+    TEST("t_update_progress_file");
+
+    std::string progress_filename = "progress_file_12362645";
+    fs::remove(progress_filename);
+
+    update_progress_file(progress_filename, 76828, 3, "1055", 1036800, 0);
+
+    std::string last_iter;
+    double last_cpu_time = -1;
+    int upload_number = -1;
+    int last_upload = -1;
+    int completed = -1;
+
+    bool ret = read_progress_file(progress_filename, last_cpu_time, upload_number, last_iter, last_upload, completed );
+    if ( !ret || last_iter != "1055" || last_cpu_time != 76828 || upload_number != 3 || last_upload != 1036800 || completed != 0 )
+    {
+        FAIL;
+        std::cout << "last_iter = " << last_iter << ", last_cpu_time = " << last_cpu_time
+                  << ", upload_number = " << upload_number << ", last_upload = " << last_upload
+                  << ", completed = " << completed << "\n";
+        return EXIT_FAILURE;
+    }
+
+    // An update with only a small cpu time change must not rewrite the file (it is replaced by rename, new inode)
+    auto inode = [&]() { struct stat st; stat(progress_filename.c_str(), &st); return st.st_ino; };
+    auto first_inode = inode();
+    update_progress_file(progress_filename, 76830, 3, "1055", 1036800, 0);
+    if ( inode() != first_inode ) {
+        FAIL; std::cout << "progress file rewritten without a change\n"; return EXIT_FAILURE;
+    }
+    update_progress_file(progress_filename, 76830, 3, "1056", 1036800, 0);
+    if ( inode() == first_inode ) {
+        FAIL; std::cout << "progress file not rewritten after a change\n"; return EXIT_FAILURE;
+    }
+
+    // A corrupted record must be rejected
+    {
+        std::fstream corrupt(progress_filename, std::ios::in | std::ios::out | std::ios::binary);
+        corrupt.seekp(20);
+        corrupt.put('\x7f');
+    }
+    if ( read_progress_file(progress_filename, last_cpu_time, upload_number, last_iter, last_upload, completed ) ) {
+        FAIL; std::cout << "corrupt progress file was accepted\n"; return EXIT_FAILURE;
+    }
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+// Test to check the background compression of upload files
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "unit_tests.h"
+#include "../CPDN_upload.h"
+
+
+ /**
+  * @brief  Test: UploadWorker
+  */
+
+int t_upload_worker()
+{
+    TEST("t_upload_worker");
+
+    // Generate some model output files to upload
+    std::vector<fs::path> files;
+    for (const auto& name : {"ICMGGtest+000012", "ICMSHtest+000012"}) {
+        std::ofstream out(name, std::ios::out | std::ios::trunc );
+        out << std::string(100000, 'x');
+        files.push_back(name);
+    }
+
+    UploadWorker worker(2);
+
+    upload_job job;
+    job.number      = 0;
+    job.last_upload = 43200;
+    job.zip_file    = "upload_worker_test_0.zip";
+    job.files       = files;
+
+    upload_job empty;
+    empty.number   = 1;
+    empty.zip_file = "upload_worker_test_1.zip";
+
+    if ( !worker.submit(job) || !worker.submit(empty) || worker.pending() > 2 ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    worker.drain();
+    auto results = worker.completed();
+    std::cout << "completed : " << results.size() << " jobs, pending = " << worker.pending() << "\n";
+
+    // Jobs complete in order; the input files are left for the caller to delete.
+    if ( results.size() != 2 || !results[0].ok || results[0].job.number != 0 || !results[1].ok ||
+         !file_exists(job.zip_file) || file_exists(empty.zip_file) || !file_exists(files[0].string()) ||
+         worker.pending() != 0 || !worker.completed().empty() ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // A missing input file must fail the job.
+    job.files.push_back("ICMUAtest+000012");
+    worker.submit(job);
+    worker.drain();
+    results = worker.completed();
+    if ( results.size() != 1 || results[0].ok ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    // A paused worker holds the job until it's resumed, as when the task is suspended.
+    job.files.pop_back();
+    worker.pause(true);
+    worker.submit(job);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    if ( worker.pending() != 1 || !worker.completed().empty() ) {
+        FAIL; return EXIT_FAILURE;
+    }
+    worker.pause(false);
+    worker.drain();
+    results = worker.completed();
+    if ( results.size() != 1 || !results[0].ok ) {
+        FAIL; return EXIT_FAILURE;
+    }
+
+    for (const auto& f : files) fs::remove(f);
+    fs::remove(job.zip_file);
+
+    SUCCESS;
+    return EXIT_SUCCESS;
+}
@@ -9,12 +9,6 @@
 #include "unit_tests.h"
 
 
- /**
-  * @brief Dummy routine to satisfy linking test code without linking against main program
-  */
-bool oifs_setenvs(const std::string& slot_path, const std::string& nthreads) { return true; }
-
-
  /****************************************
   * @brief Run tests; pass test name on command line
   * 
@@ -26,7 +20,21 @@ bool oifs_setenvs(const std::string& slot_path, const std::string& nthreads) { r
     // Map the test name (as set in CMakeLists.txt) to the test function.
     std::map< std::string, std::function<int()> > test_map = {
                 {"Read RCF File",       t_read_rcf_file},
-                {"Read Progress File",  t_read_progress_file}
+                {"Read Progress File",  t_read_progress_file},
+                {"Move File",           t_move_file},
+                {"Update Progress File", t_update_progress_file},
+                {"Proc Stat",           t_proc_stat},
+                {"Progress Estimator",  t_progress_estimator},
+                {"Upload Worker",       t_upload_worker},
+                {"Launch Model",        t_launch_model},
+                {"Topology",            t_topology},
+                {"Memory",              t_memory},
+                {"Disk Footprint",      t_disk_footprint},
+                {"Trace",               t_trace},
+                {"Trickle",             t_trickle},
+                {"Throughput",          t_throughput},
+                {"Last Lines",          t_last_lines},
+                {"Output Steps",        t_output_steps}
                 // Add new test functions here! Remember previous trailing comma!
     };
 
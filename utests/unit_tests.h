@@ -14,3 +14,17 @@
 // Declare all external test functions for main program (see individual test source files)
 int t_read_rcf_file();
 int t_read_progress_file();
+int t_move_file();
+int t_update_progress_file();
+int t_proc_stat();
+int t_progress_estimator();
+int t_upload_worker();
+int t_launch_model();
+int t_topology();
+int t_memory();
+int t_disk_footprint();
+int t_trace();
+int t_trickle();
+int t_throughput();
+int t_last_lines();
+int t_output_steps();
@@ -240,6 +240,7 @@ int main(int argc, char** argv) {
     update_progress_file(progress_file, last_cpu_time, upload_file_number, last_iter, last_upload, model_completed);
 
     fraction_done = 0;
+    ProgressEstimator progress((int) total_nsteps, progress_estimate());
     trickle_upload_count = 0;
     
     // Get result_base_name to construct upload file names using 
@@ -276,8 +277,10 @@ int main(int argc, char** argv) {
     
     
     // Start part 1 of the WRF job
-    std::string strCmd = slot_path + std::string("/real.exe");
-    handleProcess = launch_process_wrf(slot_path, strCmd.c_str());
+    launch_spec real_exe;
+    real_exe.exe = slot_path + std::string("/real.exe");
+    real_exe.env = current_environment();
+    handleProcess = launch_model(real_exe).pid;
     if (handleProcess > 0) process_status = 0;
 
     boinc_end_critical_section();
@@ -308,7 +311,8 @@ int main(int argc, char** argv) {
        }
        
        // Calculate the fraction done
-       fraction_done = model_frac_done( atof(iter.c_str()), total_nsteps, atoi(nthreads.c_str()) );
+       progress.update( atoi(iter.c_str()), current_cpu_time );
+       fraction_done = progress.fraction_done();
        //fprintf(stderr,"fraction done: %.6f\n", fraction_done);
      
 
@@ -335,8 +339,10 @@ int main(int argc, char** argv) {
     
     // If first part successful start part 2 of the WRF job
     if (process_status) {
-       std::string strCmd = slot_path + std::string("/wrf.exe");
-       handleProcess = launch_process_wrf(slot_path, strCmd.c_str());
+       launch_spec wrf_exe;
+       wrf_exe.exe = slot_path + std::string("/wrf.exe");
+       wrf_exe.env = current_environment();
+       handleProcess = launch_model(wrf_exe).pid;
        if (handleProcess > 0) process_status = 0;
 
 
@@ -354,7 +360,8 @@ int main(int argc, char** argv) {
           }
        
           // Calculate the fraction done
-          fraction_done = model_frac_done( atof(iter.c_str()), total_nsteps, atoi(nthreads.c_str()) );
+          progress.update( atoi(iter.c_str()), current_cpu_time );
+          fraction_done = progress.fraction_done();
           //fprintf(stderr,"fraction done: %.6f\n", fraction_done);
      
 
@@ -106,37 +106,44 @@ class basic_bzip2_decoder
 
     size_t decode_next() override
     {
-      // do not load any data until there
-      // are something left
-      if (_bzstream.avail_out != 0)
+      // [CPDN] bzip2 has no output until it has a whole block (up to 900 kB) of compressed data,
+      // which can be more than the input buffer. Keep reading input until there is some output,
+      // as returning 0 is taken as the end of the data and the entry was extracted truncated.
+      size_t bytesProcessed = 0;
+      do
       {
-        // if all data has not been fetched and the stream is at the end,
-        // it is an error
-        if (_endOfStream)
+        // do not load any data until there
+        // are something left
+        if (_bzstream.avail_out != 0)
         {
-          return 0;
+          // if all data has not been fetched and the stream is at the end,
+          // it is an error
+          if (_endOfStream)
+          {
+            return 0;
+          }
+
+          // read data into buffer
+          read_next();
+
+          // set input buffer and its size
+          _bzstream.next_in = reinterpret_cast<char*>(_inputBuffer);
+          _bzstream.avail_in = static_cast<unsigned int>(_inputBufferSize);
         }
 
-        // read data into buffer
-        read_next();
-
-        // set input buffer and its size
-        _bzstream.next_in = reinterpret_cast<char*>(_inputBuffer);
-        _bzstream.avail_in = static_cast<unsigned int>(_inputBufferSize);
-      }
+        // zstream output
+        _bzstream.next_out = reinterpret_cast<char*>(_outputBuffer);
+        _bzstream.avail_out = static_cast<unsigned int>(_bufferCapacity);
 
-      // zstream output
-      _bzstream.next_out = reinterpret_cast<char*>(_outputBuffer);
-      _bzstream.avail_out = static_cast<unsigned int>(_bufferCapacity);
-
-      // inflate stream
-      if (!bzip2_suceeded(BZ2_bzDecompress(&_bzstream)))
-      {
-        return 0;
-      }
+        // inflate stream
+        if (!bzip2_suceeded(BZ2_bzDecompress(&_bzstream)))
+        {
+          return 0;
+        }
 
-      // associate output buffer
-      size_t bytesProcessed = _bufferCapacity - static_cast<size_t>(_bzstream.avail_out);
+        // associate output buffer
+        bytesProcessed = _bufferCapacity - static_cast<size_t>(_bzstream.avail_out);
+      } while (bytesProcessed == 0 && _lastError != BZ_STREAM_END);
 
       // increase amount of total written bytes
       _bytesWritten += bytesProcessed;
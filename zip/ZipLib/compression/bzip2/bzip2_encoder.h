@@ -46,6 +46,12 @@ class basic_bzip2_encoder
 
     void init(ostream_type& stream, compression_encoder_properties_interface& props) override
     {
+      // [CPDN] free the state of a previous stream, so one encoder can be used for several entries
+      if (is_init())
+      {
+        BZ2_bzCompressEnd(&_bzstream);
+      }
+
       // init stream
       _stream = &stream;
 
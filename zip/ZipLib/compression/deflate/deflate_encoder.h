@@ -46,6 +46,12 @@ class basic_deflate_encoder
 
     void init(ostream_type& stream, compression_encoder_properties_interface& props) override
     {
+      // [CPDN] free the state of a previous stream, so one encoder can be used for several entries
+      if (is_init())
+      {
+        deflateEnd(&_zstream);
+      }
+
       // init stream
       _stream = &stream;
 
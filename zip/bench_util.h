@@ -0,0 +1,130 @@
+// Code shared by the benchmarks (bench_zip, bench_control, bench_functions): counting C++ allocations,
+// the command line options and writing the results as JSON.
+//
+// It replaces the global operator new and delete, so include it in only one source file of a benchmark.
+//
+//  Glenn Carver, CPDN, 2025
+
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <map>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Counting C++ allocations, for all threads. The replacements are not inlined, as GCC then takes the
+// free in operator delete for a mismatch with the new expression (-Wmismatched-new-delete).
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+inline std::atomic<std::uint64_t> bench_allocations(0);
+inline std::atomic<std::uint64_t> bench_allocated_bytes(0);
+
+BENCH_NOINLINE void* operator new(std::size_t size)
+{
+    bench_allocations.fetch_add(1, std::memory_order_relaxed);
+    bench_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc();
+}
+BENCH_NOINLINE void* operator new[](std::size_t size) { return operator new(size); }
+BENCH_NOINLINE void  operator delete(void* p) noexcept { std::free(p); }
+BENCH_NOINLINE void  operator delete[](void* p) noexcept { std::free(p); }
+BENCH_NOINLINE void  operator delete(void* p, std::size_t) noexcept { std::free(p); }
+BENCH_NOINLINE void  operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+// A JSON string value, quoted and escaped.
+inline std::string json_string(const std::string& s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n";  break;
+        case '\r': out += "\\r";  break;
+        case '\t': out += "\\t";  break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+                out += code;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+    return out + '"';
+}
+
+// The command line options of a benchmark. --label and --json are common to all of them; the others are
+// given as the options taking a value and the flags, each with what to do when it's set.
+struct bench_args
+{
+    std::string label;                  // free text stored in the results, e.g. the git commit
+    std::string json;                   // file for the results, stdout if empty
+    std::map<std::string, std::function<void(const std::string&)>> values;
+    std::map<std::string, std::function<void()>> flags;
+};
+
+// Returns -1 if the benchmark should run, otherwise its exit code: 0 after --help, 1 for a bad option.
+inline int parse_bench_args(int argc, char** argv, const std::string& name, const std::string& usage, bench_args& args)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        auto flag = args.flags.find(arg);
+        if (flag != args.flags.end())
+        {
+            flag->second();
+            continue;
+        }
+        if (arg == "--help" || arg == "-h" || i + 1 == argc)
+        {
+            std::cerr << usage;
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+        std::string value = argv[++i];
+        auto option = args.values.find(arg);
+        if      (arg == "--label")            args.label = value;
+        else if (arg == "--json")             args.json  = value;
+        else if (option != args.values.end()) option->second(value);
+        else
+        {
+            std::cerr << name << ": unknown option " << arg << '\n';
+            return 1;
+        }
+    }
+    return -1;
+}
+
+// Write the results to the --json file, or stdout. Returns false if the file can't be written.
+inline bool write_bench_json(const std::string& name, const std::string& json_file, const std::string& json)
+{
+    if (json_file.empty())
+    {
+        std::cout << json;
+        return true;
+    }
+    std::ofstream out(json_file);
+    out << json;
+    if (!out)
+    {
+        std::cerr << name << ": cannot write " << json_file << '\n';
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,359 @@
+// Benchmarks of cpdn_zip and cpdn_unzip on synthetic workloads shaped like the CPDN input and output files.
+//
+// For each workload, compression method, level and thread count, 'threads' archives are zipped (and then
+// unzipped) at the same time, one per thread, as the control code does when it stages several inputs.
+// The results are written as JSON so runs on different commits can be compared.
+//
+// Usage:  bench_zip [--size MB] [--methods store,deflate,bzip2,lzma] [--levels 0,1,6,9] [--threads 1,4]
+//                   [--workloads grib,...] [--dir path] [--label text] [--json file]
+//
+//   --size       approximate uncompressed size of each workload, MB (default 32)
+//   --levels     compression levels, 0 is the method's default (default 0)
+//   --threads    numbers of concurrent zips and unzips (default 1,4)
+//   --dir        scratch directory for the workloads and archives (default: system temp directory)
+//   --label      free text stored in the results, e.g. the git commit
+//   --json       file for the results (default: stdout)
+//
+// Per operation results are for a single cpdn_zip or cpdn_unzip call (averaged over the threads):
+//   allocations     C++ allocations (operator new), not those made by zlib or bzip2 themselves
+//   read_syscalls   read and write system calls, from /proc/self/io
+//   write_syscalls
+// peak_rss_kb is the peak resident memory of the whole benchmark while the operations run.
+// Files are read from the page cache, so MB/s is for the compression, not the disk.
+//
+//  Glenn Carver, CPDN, 2025
+
+#include "cpdn_zip.h"
+#include "bench_util.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    struct workload
+    {
+        std::string name;
+        std::vector<fs::path> files;
+        std::uint64_t bytes = 0;
+    };
+
+    struct process_counters
+    {
+        std::uint64_t allocations = 0, allocated_bytes = 0, read_syscalls = 0, write_syscalls = 0;
+    };
+
+    std::uint64_t proc_value(const std::string& path, const std::string& key)
+    {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.compare(0, key.size() + 1, key + ":") == 0) return std::strtoull(line.c_str() + key.size() + 1, nullptr, 10);
+        }
+        return 0;
+    }
+
+    process_counters sample()
+    {
+        return { bench_allocations.load(), bench_allocated_bytes.load(),
+                 proc_value("/proc/self/io", "syscr"), proc_value("/proc/self/io", "syscw") };
+    }
+
+    // Reset the peak RSS (VmHWM) so it can be read for each operation. Returns false if it can't be (before Linux 4.0).
+    bool reset_peak_rss()
+    {
+        std::ofstream clear("/proc/self/clear_refs");
+        clear << "5";
+        clear.flush();
+        return clear.good();
+    }
+
+    std::vector<std::string> split(const std::string& list)
+    {
+        std::vector<std::string> items;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ',')) if (!item.empty()) items.push_back(item);
+        return items;
+    }
+
+    // --- Synthetic files ---
+
+    // GRIB-like: messages of 16 bit packed values of a smooth field with some noise, as the model output
+    // and the initial files are. These compress by about a third with deflate, like the real ones.
+    void write_grib(const fs::path& path, std::uint64_t bytes, std::mt19937& rng)
+    {
+        std::ofstream out(path, std::ios::binary);
+        std::uniform_int_distribution<int> noise(0, 255);
+        const std::uint64_t values = 640 * 320;
+        std::vector<char> message;
+        for (std::uint64_t written = 0, field = 0; written < bytes; field++)
+        {
+            message.assign({ 'G', 'R', 'I', 'B' });
+            message.resize(100, static_cast<char>(field & 0xff));      // sections 0-4 of the header
+            for (std::uint64_t i = 0; i < values && written + message.size() < bytes; i++)
+            {
+                double x = 6.2832 * (i % 640) / 640, y = 3.1416 * (i / 640) / 320;
+                auto v = static_cast<std::uint16_t>(32768 + 20000 * std::sin(x + field) * std::cos(y) + noise(rng));
+                message.push_back(static_cast<char>(v >> 8));
+                message.push_back(static_cast<char>(v & 0xff));
+            }
+            message.insert(message.end(), { '7', '7', '7', '7' });
+            out.write(message.data(), message.size());
+            written += message.size();
+        }
+    }
+
+    // Model log lines, like NODE.001_01 and ifs.stat.
+    void write_text(const fs::path& path, std::uint64_t bytes, std::mt19937& rng)
+    {
+        std::ofstream out(path);
+        std::uniform_real_distribution<double> cpu(0.3, 0.4);
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(3);
+        for (std::uint64_t written = 0, step = 0; written < bytes; step++)
+        {
+            line.str("");
+            line << " 11:34:" << std::setw(2) << std::setfill('0') << step % 60 << std::setfill(' ')
+                 << " 0AAA00AAA STEPO " << std::setw(7) << step << "  " << std::setw(8) << cpu(rng) << "  "
+                 << std::setw(8) << cpu(rng) << "   0:02   0:02 0.1808563448E-15 0GB   0MB\n"
+                 << " NSTEP = " << step << " GPNORM T AVE " << 250 + cpu(rng) << " MIN " << 190 + cpu(rng) << '\n';
+            out << line.str();
+            written += line.str().size();
+        }
+    }
+
+    workload make_workload(const std::string& name, const fs::path& dir, std::uint64_t size, std::mt19937& rng)
+    {
+        workload w;
+        w.name = name;
+        fs::create_directories(dir / name);
+        auto add = [&](const std::string& file, std::uint64_t bytes, bool text)
+        {
+            fs::path path = dir / name / file;
+            if (text) write_text(path, bytes, rng); else write_grib(path, bytes, rng);
+            w.files.push_back(path);
+            w.bytes += fs::file_size(path);
+        };
+
+        if (name == "grib")
+        {
+            for (int i = 0; i < 4; i++) add("ICMGGh7ok+00000" + std::to_string(i), size / 4, false);
+        }
+        else if (name == "text")
+        {
+            add("NODE.001_01", size * 3 / 4, true);
+            add("ifs.stat", size / 4, true);
+        }
+        else if (name == "small_files")
+        {
+            for (int i = 0; i < 2000; i++) add("file_" + std::to_string(i), 4096, i % 2 == 0);
+        }
+        else if (name == "huge_files")
+        {
+            add("ICMSHh7okINIT", size / 2, false);
+            add("ICMGGh7okINIT", size / 2, false);
+        }
+        else if (name == "ifsdata")
+        {
+            // Climatologies and radiation tables: a few larger binary files and many small ones.
+            for (int i = 0; i < 6; i++)  add("C11_CLIM_" + std::to_string(i), size / 8, false);
+            for (int i = 0; i < 40; i++) add("RADRRTM_" + std::to_string(i), size / 160, false);
+            for (int i = 0; i < 20; i++) add("namelist_" + std::to_string(i), 2048, true);
+        }
+        else if (name == "climate_data")
+        {
+            // Initial files for one start date plus the wave model tables and namelists.
+            add("ICMGGh7okINIT", size / 2, false);
+            add("ICMSHh7okINIT", size / 4, false);
+            add("ICMCLh7okINIT", size / 8, false);
+            for (int i = 0; i < 8; i++) add("wam_grid_tables_" + std::to_string(i), size / 64, false);
+            for (int i = 0; i < 4; i++) add("fort." + std::to_string(4 + i), 4096, true);
+        }
+        return w;
+    }
+
+    const char* method_name(cpdn_zip_method method)
+    {
+        switch (method)
+        {
+        case cpdn_zip_method::store:   return "store";
+        case cpdn_zip_method::deflate: return "deflate";
+        case cpdn_zip_method::bzip2:   return "bzip2";
+        case cpdn_zip_method::lzma:    return "lzma";
+        }
+        return "";
+    }
+
+    // Runs op(i) on 'threads' threads at once. Returns false if any call failed.
+    template <typename Op>
+    bool run_threads(int threads, Op op)
+    {
+        std::vector<std::thread> workers;
+        std::atomic<bool> ok(true);
+        for (int i = 0; i < threads; i++)
+        {
+            workers.emplace_back([&, i]() { if (!op(i)) ok = false; });
+        }
+        for (auto& worker : workers) worker.join();
+        return ok;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    std::uint64_t size_mb = 32;
+    std::string methods = "store,deflate,bzip2,lzma", levels = "0", threads = "1,4";
+    std::string workloads = "grib,text,small_files,huge_files,ifsdata,climate_data";
+    fs::path dir = fs::temp_directory_path();
+
+    bench_args args;
+    args.values = {
+        { "--size",      [&](const std::string& v) { size_mb   = std::strtoull(v.c_str(), nullptr, 10); } },
+        { "--methods",   [&](const std::string& v) { methods   = v; } },
+        { "--levels",    [&](const std::string& v) { levels    = v; } },
+        { "--threads",   [&](const std::string& v) { threads   = v; } },
+        { "--workloads", [&](const std::string& v) { workloads = v; } },
+        { "--dir",       [&](const std::string& v) { dir       = v; } },
+    };
+    int exit_code = parse_bench_args(argc, argv, "bench_zip",
+                                     "Usage: bench_zip [--size MB] [--methods store,deflate,bzip2,lzma] [--levels 0,1,6,9] [--threads 1,4]\n"
+                                     "                 [--workloads " + workloads + "]\n"
+                                     "                 [--dir path] [--label text] [--json file]\n", args);
+    if (exit_code >= 0) return exit_code;
+
+    const fs::path bench_dir = dir / "bench_zip";
+    fs::remove_all(bench_dir);
+    fs::create_directories(bench_dir);
+    std::mt19937 rng(20251001);
+
+    std::ostringstream results;
+    results << std::fixed << std::setprecision(3);
+    bool first = true, all_ok = true;
+    bool rss_reset = reset_peak_rss();
+
+    for (const auto& workload_name : split(workloads))
+    {
+        workload w = make_workload(workload_name, bench_dir / "input", size_mb * 1024 * 1024, rng);
+        if (w.files.empty())
+        {
+            std::cerr << "bench_zip: unknown workload " << workload_name << '\n';
+            return 1;
+        }
+
+        for (const auto& name : split(methods))
+        {
+            cpdn_zip_control control;
+            if      (name == "store")   control.method = cpdn_zip_method::store;
+            else if (name == "deflate") control.method = cpdn_zip_method::deflate;
+            else if (name == "bzip2")   control.method = cpdn_zip_method::bzip2;
+            else if (name == "lzma")    control.method = cpdn_zip_method::lzma;
+            else
+            {
+                std::cerr << "bench_zip: unknown method " << name << '\n';
+                return 1;
+            }
+            if (!cpdn_zip_method_available(control.method))
+            {
+                std::cerr << "bench_zip: " << name << " not available in this build, skipped\n";
+                continue;
+            }
+
+            // Store has no levels.
+            std::vector<std::string> method_levels = control.method == cpdn_zip_method::store ? std::vector<std::string>{ "0" } : split(levels);
+            for (const auto& level : method_levels)
+            {
+                control.level = std::atoi(level.c_str());
+                for (const auto& nthreads_str : split(threads))
+                {
+                    int nthreads = std::max(std::atoi(nthreads_str.c_str()), 1);
+                    auto archive = [&](int i) { return bench_dir / ("archive_" + std::to_string(i) + ".zip"); };
+                    auto output  = [&](int i) { return bench_dir / ("output_" + std::to_string(i)); };
+
+                    for (const char* operation : { "zip", "unzip" })
+                    {
+                        bool zip = std::strcmp(operation, "zip") == 0;
+                        for (int i = 0; i < nthreads; i++) fs::remove_all(output(i));
+
+                        reset_peak_rss();
+                        process_counters before = sample();
+                        auto start = std::chrono::steady_clock::now();
+                        bool ok = run_threads(nthreads, [&](int i)
+                        {
+                            return zip ? cpdn_zip(archive(i), w.files, &control) : cpdn_unzip(archive(i), output(i), &control);
+                        });
+                        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                        process_counters after = sample();
+                        std::uint64_t peak_rss_kb = proc_value("/proc/self/status", "VmHWM");
+
+                        // The extracted files must be the same size as the originals.
+                        for (int i = 0; ok && !zip && i < nthreads; i++)
+                        {
+                            for (const auto& file : w.files)
+                            {
+                                std::error_code ec;
+                                if (fs::file_size(output(i) / file.filename(), ec) != fs::file_size(file)) ok = false;
+                            }
+                        }
+                        all_ok = all_ok && ok;
+
+                        std::uint64_t archive_bytes = fs::exists(archive(0)) ? fs::file_size(archive(0)) : 0;
+                        double bytes = static_cast<double>(w.bytes) * nthreads;
+                        results << (first ? "\n" : ",\n") << "    {"
+                                << "\"workload\": " << json_string(w.name) << ", \"operation\": \"" << operation << "\""
+                                << ", \"method\": \"" << method_name(control.method) << "\", \"level\": " << control.level
+                                << ", \"threads\": " << nthreads << ", \"ok\": " << (ok ? "true" : "false")
+                                << ", \"entries\": " << w.files.size() << ", \"bytes\": " << w.bytes
+                                << ", \"archive_bytes\": " << archive_bytes
+                                << ", \"ratio\": " << (archive_bytes > 0 ? static_cast<double>(w.bytes) / archive_bytes : 0.0)
+                                << ", \"seconds\": " << secs
+                                << ", \"mb_per_sec\": " << (secs > 0 ? bytes / (1024 * 1024) / secs : 0.0)
+                                << ", \"entries_per_sec\": " << (secs > 0 ? w.files.size() * nthreads / secs : 0.0)
+                                << ", \"peak_rss_kb\": " << peak_rss_kb
+                                << ", \"allocations\": " << (after.allocations - before.allocations) / nthreads
+                                << ", \"allocated_bytes\": " << (after.allocated_bytes - before.allocated_bytes) / nthreads
+                                << ", \"read_syscalls\": " << (after.read_syscalls - before.read_syscalls) / nthreads
+                                << ", \"write_syscalls\": " << (after.write_syscalls - before.write_syscalls) / nthreads
+                                << "}";
+                        first = false;
+
+                        std::cerr << std::fixed << std::setprecision(1) << w.name << ' ' << operation << ' ' << method_name(control.method)
+                                  << " level " << control.level << " threads " << nthreads << ": "
+                                  << (secs > 0 ? bytes / (1024 * 1024) / secs : 0.0) << " MB/s" << (ok ? "" : " FAILED") << '\n';
+                    }
+                    for (int i = 0; i < nthreads; i++)
+                    {
+                        fs::remove(archive(i));
+                        fs::remove_all(output(i));
+                    }
+                }
+            }
+        }
+        fs::remove_all(bench_dir / "input" / workload_name);
+    }
+    fs::remove_all(bench_dir);
+
+    std::ostringstream json;
+    json << "{\n  \"benchmark\": \"bench_zip\",\n  \"label\": " << json_string(args.label)
+         << ",\n  \"size_mb\": " << size_mb << ",\n  \"hardware_threads\": " << std::thread::hardware_concurrency()
+         << ",\n  \"peak_rss_per_operation\": " << (rss_reset ? "true" : "false")
+         << ",\n  \"results\": [" << results.str() << "\n  ]\n}\n";
+
+    if (!write_bench_json("bench_zip", args.json, json.str())) return 1;
+    return all_ok ? 0 : 1;
+}
@@ -1,49 +1,438 @@
 #include "cpdn_zip.h"
 #include "ZipLib/ZipFile.h"
 #include "ZipLib/ZipArchive.h"
+#include "ZipLib/methods/ZipMethodResolver.h"
+#include "ZipLib/extlibs/zlib/zlib.h"
 #include <iostream>
+#include <fstream>
+#include <streambuf>
+#include <memory>
+#include <list>
+#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr std::size_t BUFFER_SIZE = 1024 * 1024;     // progress & cancel are checked for every buffer
+
+    // Progress over all the files in one cpdn_zip or cpdn_unzip call.
+    class zip_progress
+    {
+    public:
+        zip_progress(const cpdn_zip_control* control, std::uint64_t total)
+            : control_(control), total_(total) {}
+
+        // Count bytes processed. Returns false if the operation has been cancelled.
+        bool add(std::uint64_t nbytes)
+        {
+            done_ += nbytes;
+            if (control_ != nullptr)
+            {
+                if (control_->progress) control_->progress(done_, total_);
+                if (control_->cancel != nullptr && control_->cancel->load()) cancelled_ = true;
+            }
+            return !cancelled_;
+        }
+
+        bool cancelled() const { return cancelled_; }
+
+    private:
+        const cpdn_zip_control* control_;
+        std::uint64_t total_;
+        std::uint64_t done_ = 0;
+        bool cancelled_ = false;
+    };
+
+    // Read buffer for a file to be compressed. It counts the data read for the progress
+    // and ends the file early if the operation is cancelled, after which the archive is discarded.
+    // The file is only opened when the entry is compressed, and closed with its buffer freed at its end,
+    // so at most one input file is open and one buffer held however many files are in the archive.
+    class progress_filebuf : public std::streambuf
+    {
+    public:
+        progress_filebuf(zip_progress& progress, const std::filesystem::path& path)
+            : progress_(progress), path_(path) {}
+
+        // True if the file couldn't be opened or read, so the archive is incomplete.
+        bool failed() const { return failed_; }
+
+    protected:
+        int_type underflow() override
+        {
+            if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+            if (progress_.cancelled() || finished_) return traits_type::eof();
+
+            if (!file_.is_open())
+            {
+                if (file_.open(path_, std::ios::in | std::ios::binary) == nullptr)
+                {
+                    std::cerr << "cpdn_zip error: Cannot open input file : " << path_ << std::endl;
+                    failed_ = finished_ = true;
+                    return traits_type::eof();
+                }
+                buffer_.resize(BUFFER_SIZE);
+            }
+
+            auto nread = file_.sgetn(buffer_.data(), buffer_.size());
+            if (nread <= 0)
+            {
+                std::vector<char>().swap(buffer_);
+                setg(nullptr, nullptr, nullptr);
+                file_.close();
+                finished_ = true;
+                return traits_type::eof();
+            }
+
+            position_ += nread;
+            setg(buffer_.data(), buffer_.data(), buffer_.data() + nread);
+            progress_.add(nread);
+            return traits_type::to_int_type(*gptr());
+        }
+
+        // Only tellg() is supported
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+        {
+            if (off == 0 && dir == std::ios_base::cur && (which & std::ios_base::in))
+            {
+                return pos_type(position_ - (egptr() - gptr()));
+            }
+            return pos_type(off_type(-1));
+        }
+
+    private:
+        zip_progress&         progress_;
+        std::filesystem::path path_;
+        std::filebuf          file_;
+        std::vector<char>     buffer_;
+        off_type              position_ = 0;
+        bool                  finished_ = false;
+        bool                  failed_   = false;
+    };
+
+    // Output file written with POSIX calls, so the data written can be passed to the kernel for
+    // writing to disk as it goes (write-behind). Supports the seeks ZipLib uses to rewrite entry headers.
+    class output_filebuf : public std::streambuf
+    {
+    public:
+        ~output_filebuf() { close(); }
+
+        // preallocate is the expected size of the file, to allocate its disk space in one go; 0 if not known.
+        bool open(const std::filesystem::path& path, bool write_behind, std::uint64_t preallocate = 0)
+        {
+            fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            write_behind_ = write_behind;
+#if defined(__linux__)
+            if (fd_ >= 0 && preallocate > 0)
+            {
+                fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, preallocate);     // only a hint, ignore failures
+            }
+#endif
+            buffer_.resize(BUFFER_SIZE);
+            setp(buffer_.data(), buffer_.data() + buffer_.size());
+            return fd_ >= 0;
+        }
+
+        // Returns false if any write failed.
+        bool close()
+        {
+            if (fd_ < 0) return !failed_;
+            if (!flush()) failed_ = true;
+            if (::close(fd_) != 0) failed_ = true;
+            fd_ = -1;
+            return !failed_;
+        }
+
+    protected:
+        int_type overflow(int_type ch) override
+        {
+            if (!flush()) return traits_type::eof();
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+            return traits_type::not_eof(ch);
+        }
+
+        int sync() override { return flush() ? 0 : -1; }
+
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+        {
+            if (!(which & std::ios_base::out) || !flush()) return pos_type(off_type(-1));
+            int whence = (dir == std::ios_base::beg) ? SEEK_SET : (dir == std::ios_base::cur) ? SEEK_CUR : SEEK_END;
+            off_t pos = ::lseek(fd_, off, whence);
+            if (pos < 0) return pos_type(off_type(-1));
+            position_ = pos;
+            return pos_type(pos);
+        }
+
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+        {
+            return seekoff(off_type(pos), std::ios_base::beg, which);
+        }
+
+    private:
+        static constexpr off_t WRITE_BEHIND_SIZE = 8 * 1024 * 1024;
+
+        bool flush()
+        {
+            const char* data = pbase();
+            std::size_t size = pptr() - pbase();
+            while (size > 0)
+            {
+                ssize_t nwritten = ::write(fd_, data, size);
+                if (nwritten < 0)
+                {
+                    if (errno == EINTR) continue;
+                    failed_ = true;
+                    return false;
+                }
+                data      += nwritten;
+                size      -= nwritten;
+                position_ += nwritten;
+            }
+            setp(buffer_.data(), buffer_.data() + buffer_.size());
+
+#if defined(__linux__)
+            // Start writeback of the data written since the last call; doesn't wait for it.
+            if (write_behind_ && position_ - synced_ >= WRITE_BEHIND_SIZE)
+            {
+                sync_file_range(fd_, synced_, position_ - synced_, SYNC_FILE_RANGE_WRITE);
+                synced_ = position_;
+            }
+#endif
+            return true;
+        }
+
+        int               fd_ = -1;
+        bool              write_behind_ = false;
+        bool              failed_ = false;
+        std::vector<char> buffer_;
+        off_t             position_ = 0;
+        off_t             synced_ = 0;
+    };
+
+    std::uint32_t read_le(const unsigned char* p, int nbytes)
+    {
+        std::uint32_t value = 0;
+        for (int i = nbytes - 1; i >= 0; --i) value = (value << 8) | p[i];
+        return value;
+    }
+
+    // Offsets of the entries' local headers, by name, and of the central directory, read from the end of
+    // the archive. ZipLib doesn't make these available. Returns false if they can't be read, e.g. Zip64.
+    bool read_entry_offsets(const std::filesystem::path& path, std::map<std::string, std::uint64_t>& offsets, std::uint64_t& cd_offset)
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::uint64_t size = std::filesystem::file_size(path);
+        if (!in || size < 22) return false;
+
+        // End of central directory record: 22 bytes plus a comment of up to 64k.
+        std::uint64_t tail_size = std::min<std::uint64_t>(size, 22 + 65535);
+        std::vector<unsigned char> tail(tail_size);
+        in.seekg(size - tail_size);
+        if (!in.read(reinterpret_cast<char*>(tail.data()), tail_size)) return false;
+
+        std::int64_t eocd = static_cast<std::int64_t>(tail_size) - 22;
+        while (eocd >= 0 && read_le(&tail[eocd], 4) != 0x06054b50) --eocd;
+        if (eocd < 0) return false;
+
+        std::uint32_t cd_size = read_le(&tail[eocd + 12], 4);
+        cd_offset             = read_le(&tail[eocd + 16], 4);
+        if (cd_offset == 0xFFFFFFFF || cd_offset + cd_size > size) return false;
+
+        std::vector<unsigned char> cd(cd_size);
+        in.seekg(cd_offset);
+        if (!in.read(reinterpret_cast<char*>(cd.data()), cd_size)) return false;
+
+        for (std::size_t pos = 0; pos + 46 <= cd.size(); )
+        {
+            if (read_le(&cd[pos], 4) != 0x02014b50) return false;
+            std::size_t name_length = read_le(&cd[pos + 28], 2);
+            std::size_t next        = pos + 46 + name_length + read_le(&cd[pos + 30], 2) + read_le(&cd[pos + 32], 2);
+            if (pos + 46 + name_length > cd.size()) return false;
+
+            std::uint32_t offset = read_le(&cd[pos + 42], 4);
+            if (offset == 0xFFFFFFFF) return false;
+            offsets[std::string(reinterpret_cast<const char*>(&cd[pos + 46]), name_length)] = offset;
+            pos = next;
+        }
+        return true;
+    }
+
+    // Free the disk space of part of a file, which then reads as zeros.
+    void punch_hole(int fd, std::uint64_t offset, std::uint64_t length)
+    {
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+        if (fd >= 0 && length > 0)
+        {
+            fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length);
+        }
+#endif
+    }
+
+    // The compression method for the entries, nullptr if it isn't available in this build.
+    ICompressionMethod::Ptr create_method(const cpdn_zip_control* control)
+    {
+        cpdn_zip_method method = control != nullptr ? control->method : cpdn_zip_method::deflate;
+        int level = control != nullptr ? std::min(std::max(control->level, 0), 9) : 0;
+
+        switch (method)
+        {
+        case cpdn_zip_method::store:
+            return StoreMethod::Create();
+        case cpdn_zip_method::deflate:
+        {
+            auto deflate = DeflateMethod::Create();
+            if (level > 0) deflate->SetCompressionLevel(static_cast<DeflateMethod::CompressionLevel>(level));
+            return deflate;
+        }
+        case cpdn_zip_method::bzip2:
+        {
+            auto bzip2 = Bzip2Method::Create();
+            if (level > 0) bzip2->SetBlockSize(static_cast<Bzip2Method::BlockSize>(level));
+            return bzip2;
+        }
+        case cpdn_zip_method::lzma:
+#ifndef ZIPLIB_NO_LZMA
+        {
+            auto lzma = LzmaMethod::Create();
+            if (level > 0) lzma->SetCompressionLevel(static_cast<LzmaMethod::CompressionLevel>(level));
+            return lzma;
+        }
+#endif
+        default:
+            return nullptr;
+        }
+    }
+
+    // An input file for the archive, which must stay in place until the archive is written.
+    struct zip_input
+    {
+        zip_input(zip_progress& progress, const std::filesystem::path& path) : buf(progress, path), stream(&buf) {}
+        progress_filebuf buf;
+        std::istream     stream;
+    };
+}
+
+
+bool cpdn_zip_method_available(cpdn_zip_method method)
+{
+    cpdn_zip_control control;
+    control.method = method;
+    return create_method(&control) != nullptr;
+}
+
 
 bool cpdn_zip(
-    const std::filesystem::path& zip_filepath, 
-    const std::vector<std::filesystem::path>& files_to_zip)
+    const std::filesystem::path& zip_filepath,
+    const std::vector<std::filesystem::path>& files_to_zip,
+    const cpdn_zip_control* control)
 {
+    // The archive is built in one pass and only replaces zip_filepath once it is complete.
+    // (ZipFile::AddFile rewrites the whole archive for every file added.)
+    std::filesystem::path tmp_filepath = zip_filepath.string() + ".tmp";
+
     try
     {
-        // If the zip file exists, ZipFile::AddFile will append to it.
-        // To create a fresh archive, we should remove it first.
-        if (std::filesystem::exists(zip_filepath))
+        std::uint64_t total = 0;
+        for (const auto& file_path : files_to_zip)
         {
-            std::filesystem::remove(zip_filepath);
+            if (!std::filesystem::exists(file_path))
+            {
+                std::cerr << "cpdn_zip error: File not found : " << file_path << std::endl;
+                return false;
+            }
+            total += std::filesystem::file_size(file_path);
+        }
+
+        // The entries are compressed one after another when the archive is written, so they share one
+        // method and its encoder; one each would keep every encoder's buffers until the archive is written.
+        // (LZMA's encoder runs a thread per entry, so it's not shared.)
+        auto method = create_method(control);
+        if (method == nullptr)
+        {
+            std::cerr << "cpdn_zip error: Compression method not available in this build" << std::endl;
+            return false;
         }
+        const bool share_method = control == nullptr || control->method != cpdn_zip_method::lzma;
+
+        zip_progress progress(control, total);
+        std::list<zip_input> inputs;
+        auto archive = ZipArchive::Create();
 
         for (const auto& file_path : files_to_zip)
         {
-            if (std::filesystem::exists(file_path))
+            inputs.emplace_back(progress, file_path);
+
+            // If the same name is given twice the last file is kept, as ZipFile::AddFile does.
+            auto name  = file_path.filename().string();
+            auto entry = archive->CreateEntry(name);
+            if (entry == nullptr)
+            {
+                archive->RemoveEntry(name);
+                entry = archive->CreateEntry(name);
+            }
+            entry->SetCompressionStream(inputs.back().stream, share_method ? method : create_method(control));
+        }
+
+        bool ok = true;
+        {
+            output_filebuf buf;
+            if (!buf.open(tmp_filepath, control != nullptr && control->write_behind))
             {
-                // Use the static AddFile method.
-                // It takes the archive path, the file to add, and the name inside the archive.
-                ZipFile::AddFile(zip_filepath.string(), file_path.string(), file_path.filename().string());
+                std::cerr << "cpdn_zip error: Cannot create zip file : " << tmp_filepath << std::endl;
+                return false;
             }
-            else
+            std::ostream out(&buf);
+            archive->WriteToStream(out);
+            out.flush();
+            ok = !out.fail() && buf.close();
+        }
+
+        if (progress.cancelled())
+        {
+            std::filesystem::remove(tmp_filepath);
+            return false;
+        }
+        for (const auto& input : inputs)
+        {
+            if (input.buf.failed())
             {
-                std::cerr << "cpdn_zip error: File not found : " << file_path << std::endl;
+                std::filesystem::remove(tmp_filepath);
                 return false;
             }
         }
+        if (!ok)
+        {
+            std::cerr << "cpdn_zip error: Writing zip file failed : " << tmp_filepath << std::endl;
+            std::filesystem::remove(tmp_filepath);
+            return false;
+        }
+
+        std::filesystem::rename(tmp_filepath, zip_filepath);
         return true;
     }
     catch (const std::exception& e)
     {
         std::cerr << "cpdn_zip exception: " << e.what() << std::endl;
+        std::error_code ec;
+        std::filesystem::remove(tmp_filepath, ec);
         return false;
     }
 }
 
 
 bool cpdn_unzip(
-    const std::filesystem::path& zip_filepath, 
-    const std::filesystem::path& output_directory)
+    const std::filesystem::path& zip_filepath,
+    const std::filesystem::path& output_directory,
+    const cpdn_zip_control* control)
 {
+    std::filesystem::path destination_path;
+
     try
     {
         // Open the archive to inspect its contents
@@ -56,15 +445,54 @@ bool cpdn_unzip(
             return false;
         }
 
-        for (auto i = 0; i < archive->GetEntriesCount(); ++i)
+        std::uint64_t total = 0;
+        const int nentries = static_cast<int>(archive->GetEntriesCount());
+        for (int i = 0; i < nentries; ++i)
+        {
+            total += archive->GetEntry(i)->GetSize();
+        }
+        zip_progress progress(control, total);
+        std::vector<char> buffer(BUFFER_SIZE);
+
+        // Extract the entries in the order they are in the file. If the offsets aren't known, the archive
+        // order is used and no space is freed from the archive while extracting.
+        const bool consume = control != nullptr && control->consume_archive;
+        std::vector<int> order(archive->GetEntriesCount());
+        std::vector<std::uint64_t> offsets(order.size(), 0);
+        std::uint64_t cd_offset = 0;
+        for (std::size_t i = 0; i < order.size(); ++i) order[i] = static_cast<int>(i);
+
+        std::map<std::string, std::uint64_t> offset_by_name;
+        bool have_offsets = read_entry_offsets(zip_filepath, offset_by_name, cd_offset) &&
+                            offset_by_name.size() == order.size();
+        for (std::size_t i = 0; i < order.size() && have_offsets; ++i)
+        {
+            auto found = offset_by_name.find(archive->GetEntry(static_cast<int>(i))->GetFullName());
+            have_offsets = (found != offset_by_name.end());
+            if (have_offsets) offsets[i] = found->second;
+        }
+        if (have_offsets)
+        {
+            std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return offsets[a] < offsets[b]; });
+        }
+
+        int punch_fd = -1;
+        if (consume && have_offsets)
         {
+            punch_fd = ::open(zip_filepath.c_str(), O_WRONLY | O_CLOEXEC);
+        }
+        struct fd_closer { int& fd; ~fd_closer() { if (fd >= 0) ::close(fd); } } close_punch_fd{punch_fd};
+
+        for (std::size_t n = 0; n < order.size(); ++n)
+        {
+            const int i = order[n];
             auto entry = archive->GetEntry(i);      // this will throw exception if entry is null
             if (entry)
             {
                 // Construct full destination path : implicitly assumes a relative path in the compressed archive
-                auto destination_path = output_directory / entry->GetFullName();
+                destination_path = output_directory / entry->GetFullName();
                 //std::cerr << "Extracting: " << entry->GetFullName() << " to " << destination_path << std::endl;
-                
+
                 // Ensure parent directory exists
                 if (destination_path.has_parent_path())
                 {
@@ -74,10 +502,75 @@ bool cpdn_unzip(
 
                 //std::cerr << "IsDirectory: " << (entry->IsDirectory() ? "Yes" : "No") << std::endl;
                 if ( !entry->IsDirectory() ) {
-                    ZipFile::ExtractFile(zip_filepath.string(), entry->GetFullName(), destination_path.string());
+                    // Extract from the archive already open, rather than ZipFile::ExtractFile which reopens it.
+                    std::istream* data = entry->GetDecompressionStream();
+                    if (data == nullptr)
+                    {
+                        std::cerr << "cpdn_unzip error: Cannot extract : " << entry->GetFullName() << std::endl;
+                        return false;
+                    }
+
+                    output_filebuf buf;
+                    if (!buf.open(destination_path, control != nullptr && control->write_behind, consume ? entry->GetSize() : 0))
+                    {
+                        std::cerr << "cpdn_unzip error: Cannot create destination file : " << destination_path << std::endl;
+                        return false;
+                    }
+
+                    std::ostream out(&buf);
+                    bool cancelled = false;
+                    std::uint64_t nwritten = 0;
+                    uLong crc = crc32(0L, Z_NULL, 0);
+                    while (data->good() && !cancelled)
+                    {
+                        data->read(buffer.data(), buffer.size());
+                        auto nread = data->gcount();
+                        if (nread <= 0) break;
+                        out.write(buffer.data(), nread);
+                        crc = crc32(crc, reinterpret_cast<const Bytef*>(buffer.data()), static_cast<uInt>(nread));
+                        nwritten += nread;
+                        cancelled = !progress.add(nread);
+                    }
+                    entry->CloseDecompressionStream();
+                    out.flush();
+                    bool written = !out.fail() && buf.close();
+
+                    if (cancelled)
+                    {
+                        std::filesystem::remove(destination_path);
+                        return false;
+                    }
+                    if (!written)
+                    {
+                        std::cerr << "cpdn_unzip error: Writing destination file failed : " << destination_path << std::endl;
+                        return false;
+                    }
+
+                    // A short read from the decompression stream is not an error of the stream, so check
+                    // the entry came out whole before the archive is consumed.
+                    if (nwritten != entry->GetSize() || crc != entry->GetCrc32())
+                    {
+                        std::cerr << "cpdn_unzip error: Extracted " << nwritten << " of " << entry->GetSize()
+                                  << " bytes, or the CRC does not match, for : " << entry->GetFullName() << std::endl;
+                        std::filesystem::remove(destination_path);
+                        return false;
+                    }
+                }
+
+                // This entry has been read, free its space in the archive up to the next entry.
+                if (punch_fd >= 0)
+                {
+                    std::uint64_t end = (n + 1 < order.size()) ? offsets[order[n + 1]] : cd_offset;
+                    punch_hole(punch_fd, offsets[i], end - offsets[i]);
                 }
             }
         }
+
+        if (consume)
+        {
+            archive.reset();
+            std::filesystem::remove(zip_filepath);
+        }
         return true;
     }
     catch (const std::exception& e)
@@ -1,29 +1,82 @@
 #pragma once
 
 #include <vector>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <filesystem>
 
+/**
+ * @brief Compression methods for cpdn_zip. LZMA is only available if ZipLib is built with it (see CMakeLists.txt).
+ */
+enum class cpdn_zip_method { store, deflate, bzip2, lzma };
+
+/**
+ * @brief Optional progress reporting and cancellation for cpdn_zip and cpdn_unzip.
+ *
+ * Both are checked for every buffer of data read or written, so a long operation can be
+ * stopped within a fraction of a second.
+ */
+struct cpdn_zip_control {
+    // Called with the bytes of uncompressed data processed so far and the total to process.
+    std::function<void(std::uint64_t done, std::uint64_t total)> progress;
+
+    // When set true, e.g. from the progress callback or another thread, the operation stops
+    // and returns false. A cancelled cpdn_zip leaves no archive; a cancelled cpdn_unzip
+    // removes the partly extracted file. The operation can be repeated later.
+    const std::atomic<bool>* cancel = nullptr;
+
+    // Start writing the output to disk every few MB as it is written (sync_file_range, Linux only),
+    // rather than leaving it all as dirty pages in the page cache until the file is closed.
+    bool write_behind = false;
+
+    // For cpdn_unzip of a copy of an archive that's not needed afterwards, to keep the disk space used
+    // close to the size of the extracted files: the space of each extracted entry is freed from the archive
+    // (punched out, Linux only) as it goes, and the archive is deleted once everything is extracted.
+    // Each file is also allocated its full size before it's written. The archive is left partly freed
+    // if the unzip fails, so it can't be used again.
+    bool consume_archive = false;
+
+    // Compression used by cpdn_zip. The level is 1 (fastest) to 9 (best), or 0 for the method's default;
+    // for bzip2 it's the block size in 100 kB. cpdn_unzip reads whichever method each entry was written with.
+    cpdn_zip_method method = cpdn_zip_method::deflate;
+    int level = 0;
+};
+
+/**
+ * @brief Whether cpdn_zip can write archives with the given compression method.
+ */
+bool cpdn_zip_method_available(cpdn_zip_method method);
+
 /**
  * @brief Zips a list of files into a single zip archive using ZipLib.
  *
+ * The archive is written to a temporary file which replaces zip_filepath once it is complete.
+ *
  * @param zip_filepath The path to the output zip archive to be created.
  * @param files_to_zip A vector of paths to the files that should be included in the zip.
- * @return bool Returns true on success, false on failure.
+ * @param control Optional progress callback and cancellation flag.
+ * @return bool Returns true on success, false on failure or if cancelled.
  */
 bool cpdn_zip(
     const std::filesystem::path& zip_filepath, 
-    const std::vector<std::filesystem::path>& files_to_zip
+    const std::vector<std::filesystem::path>& files_to_zip,
+    const cpdn_zip_control* control = nullptr
 );
 
 /**
  * @brief Unzips a zip archive to a specified directory using ZipLib.
  *
+ * Entries are extracted in the order they are stored in the archive, so it is read sequentially.
+ *
  * @param zip_filepath The path to the zip archive to be extracted.
  * @param output_directory The directory where the contents should be extracted.
- * @return bool Returns true on success, false on failure.
+ * @param control Optional progress callback and cancellation flag.
+ * @return bool Returns true on success, false on failure or if cancelled.
  */
 bool cpdn_unzip(
     const std::filesystem::path& zip_filepath, 
-    const std::filesystem::path& output_directory
+    const std::filesystem::path& output_directory,
+    const cpdn_zip_control* control = nullptr
 );
 
@@ -4,6 +4,9 @@
 #include <vector>
 #include <filesystem>
 #include <cassert>
+#include <atomic>
+#include <iterator>
+#include <sys/resource.h>
 
 int main() {
     // --- Setup Test Environment ---
@@ -60,6 +63,136 @@ int main() {
     assert(extracted_content == app_content && "Extracted file content must match original.");
     std::cout << "SUCCESS: Extracted file content matches original." << std::endl;
 
+    // --- Test progress and cancel ---
+    std::cout << "\n--- Testing cpdn_zip progress and cancel ---" << std::endl;
+    const std::filesystem::path big_path = test_dir / "ICMGGtest+000024";
+    const std::filesystem::path big_zip  = slot_dir / "big.zip";
+    {
+        std::ofstream big(big_path, std::ios::binary);
+        for (int i = 0; i < 3 * 1024 * 1024; i++) big.put(static_cast<char>(i % 251));
+    }
+
+    std::atomic<bool> cancel(false);
+    std::uint64_t last_done = 0, last_total = 0;
+    cpdn_zip_control control;
+    control.cancel   = &cancel;
+    control.progress = [&](std::uint64_t done, std::uint64_t total) { last_done = done; last_total = total; };
+
+    zip_result = cpdn_zip(big_zip, { big_path, app_path }, &control);
+    std::cout << "cpdn_zip progress: " << last_done << " of " << last_total << " bytes" << std::endl;
+    assert(zip_result && last_done == last_total && last_total == std::filesystem::file_size(big_path) + app_content.size());
+
+    unzip_result = cpdn_unzip(big_zip, extraction_dir, &control);
+    assert(unzip_result && last_done == last_total);
+    assert(std::filesystem::file_size(extraction_dir / big_path.filename()) == std::filesystem::file_size(big_path));
+
+    // Cancel after the first buffer: no archive or temporary file is left, nor a partly extracted file.
+    std::filesystem::remove(big_zip);
+    control.progress = [&](std::uint64_t, std::uint64_t) { cancel = true; };
+    zip_result = cpdn_zip(big_zip, { big_path }, &control);
+    assert(!zip_result && !std::filesystem::exists(big_zip) && !std::filesystem::exists(big_zip.string() + ".tmp"));
+
+    cancel = false;
+    control.progress = nullptr;
+    assert(cpdn_zip(big_zip, { big_path }, &control));
+    std::filesystem::remove(extraction_dir / big_path.filename());
+    control.progress = [&](std::uint64_t, std::uint64_t) { cancel = true; };
+    unzip_result = cpdn_unzip(big_zip, extraction_dir, &control);
+    assert(!unzip_result && !std::filesystem::exists(extraction_dir / big_path.filename()));
+    std::cout << "SUCCESS: cancelled cpdn_zip and cpdn_unzip left no files." << std::endl;
+
+    // --- Test more files than can be open at once ---
+    // Each input file is only open while its entry is compressed.
+    std::cout << "\n--- Testing cpdn_zip with more files than the open file limit ---" << std::endl;
+    const std::filesystem::path many_dir = test_dir / "many";
+    std::filesystem::create_directory(many_dir);
+    std::vector<std::filesystem::path> many_files;
+    for (int i = 0; i < 300; i++)
+    {
+        many_files.push_back(many_dir / ("ICMUAtest+" + std::to_string(i)));
+        std::ofstream small(many_files.back());
+        small << "file " << i;
+    }
+    struct rlimit nofile, low_nofile;
+    getrlimit(RLIMIT_NOFILE, &nofile);
+    low_nofile = nofile;
+    low_nofile.rlim_cur = 64;
+    setrlimit(RLIMIT_NOFILE, &low_nofile);
+    zip_result = cpdn_zip(big_zip, many_files);
+    setrlimit(RLIMIT_NOFILE, &nofile);
+    assert(zip_result && cpdn_unzip(big_zip, extraction_dir));
+    assert(std::filesystem::exists(extraction_dir / many_files.back().filename()));
+    std::cout << "SUCCESS: zipped " << many_files.size() << " files with " << low_nofile.rlim_cur << " open files allowed." << std::endl;
+    // --- Test write-behind ---
+    std::cout << "\n--- Testing cpdn_zip and cpdn_unzip with write-behind ---" << std::endl;
+    {
+        std::ofstream big(big_path, std::ios::binary | std::ios::trunc);
+        for (int i = 0; i < 20 * 1024 * 1024; i++) big.put(static_cast<char>((i * 7919) % 253));
+    }
+    cancel = false;
+    control.progress = nullptr;
+    control.write_behind = true;
+    std::filesystem::remove(extraction_dir / big_path.filename());
+    assert(cpdn_zip(big_zip, { big_path }, &control) && cpdn_unzip(big_zip, extraction_dir, &control));
+    {
+        std::ifstream original(big_path, std::ios::binary), extracted(extraction_dir / big_path.filename(), std::ios::binary);
+        std::string a((std::istreambuf_iterator<char>(original)), std::istreambuf_iterator<char>());
+        std::string b((std::istreambuf_iterator<char>(extracted)), std::istreambuf_iterator<char>());
+        assert(a.size() == 20 * 1024 * 1024 && a == b);
+    }
+    std::cout << "SUCCESS: Extracted file matches original." << std::endl;
+
+    // --- Test consuming the archive ---
+    std::cout << "\n--- Testing cpdn_unzip consuming the archive ---" << std::endl;
+    control.consume_archive = true;
+    std::filesystem::remove(extraction_dir / big_path.filename());
+    std::filesystem::remove(extraction_dir / app_path.filename());
+    assert(cpdn_zip(big_zip, { app_path, big_path }, nullptr) && cpdn_unzip(big_zip, extraction_dir, &control));
+    assert(!std::filesystem::exists(big_zip));
+    {
+        std::ifstream original(big_path, std::ios::binary), extracted(extraction_dir / big_path.filename(), std::ios::binary);
+        std::string a((std::istreambuf_iterator<char>(original)), std::istreambuf_iterator<char>());
+        std::string b((std::istreambuf_iterator<char>(extracted)), std::istreambuf_iterator<char>());
+        assert(a == b && std::filesystem::file_size(extraction_dir / app_path.filename()) == std::filesystem::file_size(app_path));
+    }
+    std::cout << "SUCCESS: Extracted files match originals and the archive was removed." << std::endl;
+
+    // --- Test the other compression methods ---
+    // The file is not very compressible, so a bzip2 block is more than the decoder's input buffer.
+    std::cout << "\n--- Testing cpdn_zip and cpdn_unzip with store and bzip2 ---" << std::endl;
+    {
+        std::ofstream big(big_path, std::ios::binary | std::ios::trunc);
+        std::uint32_t x = 12345;
+        for (int i = 0; i < 2 * 1024 * 1024; i++) { x = x * 1103515245 + 12345; big.put(static_cast<char>((i % 97) + (x >> 28))); }
+    }
+    control = cpdn_zip_control();
+    for (auto method : { cpdn_zip_method::store, cpdn_zip_method::bzip2 })
+    {
+        control.method = method;
+        std::filesystem::remove(extraction_dir / big_path.filename());
+        assert(cpdn_zip(big_zip, { big_path }, &control) && cpdn_unzip(big_zip, extraction_dir, &control));
+        std::ifstream original(big_path, std::ios::binary), extracted(extraction_dir / big_path.filename(), std::ios::binary);
+        std::string a((std::istreambuf_iterator<char>(original)), std::istreambuf_iterator<char>());
+        std::string b((std::istreambuf_iterator<char>(extracted)), std::istreambuf_iterator<char>());
+        assert(a == b);
+    }
+    std::cout << "SUCCESS: Extracted files match originals." << std::endl;
+
+    // --- Test a damaged entry is not extracted ---
+    std::cout << "\n--- Testing cpdn_unzip with a damaged entry ---" << std::endl;
+    control.method = cpdn_zip_method::store;
+    assert(cpdn_zip(big_zip, { big_path }, &control));
+    {
+        std::fstream damage(big_zip, std::ios::in | std::ios::out | std::ios::binary);
+        damage.seekg(1024 * 1024);
+        char c = static_cast<char>(damage.get() ^ 0xff);
+        damage.seekp(1024 * 1024);
+        damage.put(c);
+    }
+    std::filesystem::remove(extraction_dir / big_path.filename());
+    assert(!cpdn_unzip(big_zip, extraction_dir, &control) && !std::filesystem::exists(extraction_dir / big_path.filename()));
+    std::cout << "SUCCESS: Damaged entry was rejected." << std::endl;
+
     // --- Clean up ---
     //std::cout << "\nCleaning up test directory..." << std::endl;
     //std::filesystem::remove_all(test_dir);